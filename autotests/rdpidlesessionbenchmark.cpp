@@ -0,0 +1,126 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <atomic>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#include <winpr/synch.h>
+
+// CPU used by idle RDP session threads. Each thread waits like
+// RdpSession::run() on a handle nothing signals, standing for the FreeRDP
+// handles of a session where nothing happens, either along with the 1 ms
+// periodic timer the loop used to arm or with the wakeup event only.
+class RdpIdleSessionBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void idle_data();
+    void idle();
+};
+
+static const int IDLE_MSECS = 1000;
+
+static qint64 processCpuNsecs()
+{
+    timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return qint64(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+struct IdleSession {
+    HANDLE wakeupEvent = nullptr;
+    HANDLE serverEvent = nullptr;
+    HANDLE timer = nullptr;
+    std::atomic<bool> stopped{false};
+    std::atomic<quint64> wakeups{0};
+    std::thread thread;
+
+    void run()
+    {
+        HANDLE handles[3] = {};
+        DWORD count = 0;
+        if (timer) {
+            handles[count++] = timer;
+        }
+        handles[count++] = wakeupEvent;
+        handles[count++] = serverEvent;
+        while (!stopped) {
+            if (WaitForMultipleObjects(count, handles, FALSE, INFINITE) == WAIT_FAILED) {
+                break;
+            }
+            wakeups++;
+        }
+    }
+};
+
+void RdpIdleSessionBenchmark::idle_data()
+{
+    QTest::addColumn<int>("sessions");
+    QTest::addColumn<bool>("timer");
+    for (int sessions : {1, 4, 16}) {
+        QTest::addRow("%d sessions, 1 ms timer", sessions) << sessions << true;
+        QTest::addRow("%d sessions, wakeup event", sessions) << sessions << false;
+    }
+}
+
+void RdpIdleSessionBenchmark::idle()
+{
+    QFETCH(int, sessions);
+    QFETCH(bool, timer);
+
+    std::vector<IdleSession> idleSessions(sessions);
+    for (IdleSession &session : idleSessions) {
+        session.wakeupEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+        session.serverEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+        QVERIFY(session.wakeupEvent && session.serverEvent);
+        if (timer) {
+            session.timer = CreateWaitableTimerA(nullptr, FALSE, nullptr);
+            QVERIFY(session.timer);
+            LARGE_INTEGER due;
+            due.QuadPart = 0;
+            QVERIFY(SetWaitableTimer(session.timer, &due, 1, nullptr, nullptr, false));
+        }
+    }
+
+    const qint64 cpuStart = processCpuNsecs();
+    for (IdleSession &session : idleSessions) {
+        session.thread = std::thread(&IdleSession::run, &session);
+    }
+    QTest::qSleep(IDLE_MSECS);
+
+    quint64 wakeups = 0;
+    for (IdleSession &session : idleSessions) {
+        session.stopped = true;
+        SetEvent(session.wakeupEvent);
+        session.thread.join();
+        wakeups += session.wakeups;
+    }
+    const qint64 cpuNsecs = processCpuNsecs() - cpuStart;
+
+    for (IdleSession &session : idleSessions) {
+        if (session.timer) {
+            CloseHandle(session.timer);
+        }
+        CloseHandle(session.serverEvent);
+        CloseHandle(session.wakeupEvent);
+    }
+
+    qInfo("%d idle sessions for %d ms: %llu wakeups, %.1f ms of CPU time", sessions, IDLE_MSECS, wakeups, cpuNsecs / 1e6);
+    QTest::setBenchmarkResult(wakeups, QTest::Events);
+    if (!timer) {
+        // Only the wakeup from stopping.
+        QCOMPARE(wakeups, quint64(sessions));
+    }
+}
+
+QTEST_GUILESS_MAIN(RdpIdleSessionBenchmark)
+
+#include "rdpidlesessionbenchmark.moc"
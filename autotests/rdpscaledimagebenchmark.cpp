@@ -0,0 +1,115 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "rdpscaledimage.h"
+#include "testimages.h"
+
+#include <QImage>
+#include <QTest>
+
+#include <cstring>
+
+// Painting a scaled RDP session used to scale the whole video buffer for
+// every paint. Compare that with scaling only a caret sized change.
+class RdpScaledImageBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void incrementalMatchesFull();
+    void fullFrame_data();
+    void fullFrame();
+    void caret_data();
+    void caret();
+
+private:
+    void addSizes();
+};
+
+// Largest difference of any channel of any pixel of two images of the same
+// size and format.
+static int maxDifference(const QImage &a, const QImage &b)
+{
+    int difference = 0;
+    for (int y = 0; y < a.height(); ++y) {
+        const uchar *lineA = a.constScanLine(y);
+        const uchar *lineB = b.constScanLine(y);
+        for (int i = 0; i < a.width() * 4; ++i) {
+            difference = qMax(difference, qAbs(lineA[i] - lineB[i]));
+        }
+    }
+    return difference;
+}
+
+void RdpScaledImageBenchmark::addSizes()
+{
+    QTest::addColumn<QSize>("sourceSize");
+    QTest::addColumn<QSize>("viewSize");
+    QTest::newRow("1080p") << QSize(1920, 1080) << QSize(1440, 810);
+    QTest::newRow("4K") << QSize(3840, 2160) << QSize(2880, 1620);
+}
+
+void RdpScaledImageBenchmark::incrementalMatchesFull()
+{
+    const QSize viewSize(1000, 600);
+    QImage source = randomImage(QSize(1920, 1080), QImage::Format_RGBA8888);
+    RdpScaledImage incremental;
+    incremental.update(source, viewSize, QRegion());
+
+    const QRegion damage = QRegion(101, 203, 16, 16) + QRect(1500, 17, 300, 200);
+    const QImage changes = randomImage(source.size(), QImage::Format_RGBA8888);
+    for (const QRect &rect : damage) {
+        for (int y = rect.top(); y <= rect.bottom(); ++y) {
+            memcpy(source.scanLine(y) + rect.x() * 4, changes.constScanLine(y) + rect.x() * 4, rect.width() * 4);
+        }
+    }
+    incremental.update(source, viewSize, damage);
+
+    RdpScaledImage full;
+    full.update(source, viewSize, QRegion());
+    QCOMPARE(incremental.image().size(), full.image().size());
+    // Allow for rounding differences between the two ways.
+    QVERIFY(maxDifference(incremental.image(), full.image()) <= 2);
+}
+
+void RdpScaledImageBenchmark::fullFrame_data()
+{
+    addSizes();
+}
+
+void RdpScaledImageBenchmark::fullFrame()
+{
+    QFETCH(QSize, sourceSize);
+    QFETCH(QSize, viewSize);
+    const QImage source = randomImage(sourceSize, QImage::Format_RGBA8888);
+
+    QBENCHMARK {
+        const QImage scaled = source.scaled(viewSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        Q_UNUSED(scaled);
+    }
+}
+
+void RdpScaledImageBenchmark::caret_data()
+{
+    addSizes();
+}
+
+void RdpScaledImageBenchmark::caret()
+{
+    QFETCH(QSize, sourceSize);
+    QFETCH(QSize, viewSize);
+    const QImage source = randomImage(sourceSize, QImage::Format_RGBA8888);
+    RdpScaledImage scaled;
+    scaled.update(source, viewSize, QRegion());
+
+    QBENCHMARK {
+        scaled.update(source, viewSize, QRect(400, 300, 16, 16));
+    }
+}
+
+QTEST_GUILESS_MAIN(RdpScaledImageBenchmark)
+
+#include "rdpscaledimagebenchmark.moc"
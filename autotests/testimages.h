@@ -0,0 +1,25 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#ifndef TESTIMAGES_H
+#define TESTIMAGES_H
+
+#include <QImage>
+#include <QRandomGenerator>
+
+// An image of the given size and format filled with random pixels, the same
+// for every run.
+inline QImage randomImage(const QSize &size, QImage::Format format)
+{
+    QImage image(size, format);
+    QRandomGenerator random(42);
+    for (int y = 0; y < image.height(); ++y) {
+        random.fillRange(reinterpret_cast<quint32 *>(image.scanLine(y)), image.bytesPerLine() / sizeof(quint32));
+    }
+    return image;
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "vncencodingcontroller.h"
+
+#include <QTest>
+
+static const qint64 MSEC = 1000 * 1000;
+
+class VncEncodingControllerTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void sparseUpdatesKeepProfile();
+    void unknownRoundTripKeepsProfile();
+    void idleLinkSwitchesToLossless();
+    void congestedLinkSwitchesToCompact();
+
+private:
+    // Feed sample every 200 ms for 30 s, returns whether the profile changed.
+    bool addSamples(VncEncodingController &controller, const VncEncodingController::Sample &sample);
+};
+
+bool VncEncodingControllerTest::addSamples(VncEncodingController &controller, const VncEncodingController::Sample &sample)
+{
+    for (qint64 now = 200 * MSEC; now <= 30000 * MSEC; now += 200 * MSEC) {
+        if (controller.addSample(sample, now)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// An idle desktop on a fast link: a blinking caret, one small update a
+// second, quickly sent and decoded. The server holds each update request
+// until the caret blinks, which must not be taken for a slow link, nor the
+// small updates for room to spare.
+void VncEncodingControllerTest::sparseUpdatesKeepProfile()
+{
+    VncEncodingController controller;
+    controller.reset(RemoteView::Medium);
+
+    VncEncodingController::Sample sample;
+    sample.wallNsecs = 2 * MSEC;
+    sample.cpuNsecs = 1 * MSEC;
+    sample.roundTripNsecs = 1 * MSEC;
+    sample.pixels = 16 * 16;
+
+    for (int second = 1; second <= 120; ++second) {
+        QVERIFY(!controller.addSample(sample, second * 1000 * MSEC));
+    }
+    QCOMPARE(controller.profile().name, "balanced");
+}
+
+// Full screen updates, quickly sent and decoded, but without TCP_INFO.
+void VncEncodingControllerTest::unknownRoundTripKeepsProfile()
+{
+    VncEncodingController controller;
+    controller.reset(RemoteView::Medium);
+
+    VncEncodingController::Sample sample;
+    sample.wallNsecs = 10 * MSEC;
+    sample.cpuNsecs = 5 * MSEC;
+    sample.roundTripNsecs = -1;
+    sample.pixels = 1920 * 1080;
+
+    QVERIFY(!addSamples(controller, sample));
+    QCOMPARE(controller.profile().name, "balanced");
+}
+
+// The same on a link known to be fast.
+void VncEncodingControllerTest::idleLinkSwitchesToLossless()
+{
+    VncEncodingController controller;
+    controller.reset(RemoteView::Medium);
+
+    VncEncodingController::Sample sample;
+    sample.wallNsecs = 10 * MSEC;
+    sample.cpuNsecs = 5 * MSEC;
+    sample.roundTripNsecs = 1 * MSEC;
+    sample.pixels = 1920 * 1080;
+
+    QVERIFY(addSamples(controller, sample));
+    QCOMPARE(controller.profile().name, "lossless");
+}
+
+void VncEncodingControllerTest::congestedLinkSwitchesToCompact()
+{
+    VncEncodingController controller;
+    controller.reset(RemoteView::High);
+
+    // Most of each update is spent waiting for data.
+    VncEncodingController::Sample sample;
+    sample.wallNsecs = 150 * MSEC;
+    sample.cpuNsecs = 10 * MSEC;
+    sample.roundTripNsecs = 80 * MSEC;
+    sample.pixels = 1920 * 1080;
+
+    QVERIFY(addSamples(controller, sample));
+    QCOMPARE(controller.profile().name, "balanced");
+}
+
+QTEST_GUILESS_MAIN(VncEncodingControllerTest)
+
+#include "vncencodingcontrollertest.moc"
@@ -0,0 +1,59 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "vncpixelconversion.h"
+#include "testimages.h"
+
+#include <QImage>
+#include <QRegion>
+#include <QTest>
+#include <QThread>
+#include <QThreadPool>
+
+// How converting a full screen update at 4K into the published RGB32
+// frame scales with the number of threads helping the calling one. Only
+// this conversion is split, decoding stays serial inside libvncclient. For
+// 32 bit framebuffers the conversion is a plain copy.
+class VncImageRegionBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void convert_data();
+    void convert();
+};
+
+static const QSize FRAME_SIZE(3840, 2160);
+
+void VncImageRegionBenchmark::convert_data()
+{
+    QTest::addColumn<int>("format");
+    QTest::addColumn<int>("threads");
+    for (int threads = 0; threads <= qMax(3, QThread::idealThreadCount() - 1); ++threads) {
+        QTest::addRow("16 bit, %d helper threads", threads) << int(QImage::Format_RGB16) << threads;
+        QTest::addRow("32 bit, %d helper threads", threads) << int(QImage::Format_RGB32) << threads;
+    }
+}
+
+void VncImageRegionBenchmark::convert()
+{
+    QFETCH(int, format);
+    QFETCH(int, threads);
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, threads));
+    const QImage source = randomImage(FRAME_SIZE, QImage::Format(format));
+    QImage converted(FRAME_SIZE, QImage::Format_RGB32);
+
+    QBENCHMARK {
+        convertImageRegion(converted, source, source.rect(), threads > 0 ? &pool : nullptr);
+    }
+
+    QCOMPARE(converted, source.convertToFormat(QImage::Format_RGB32));
+}
+
+QTEST_GUILESS_MAIN(VncImageRegionBenchmark)
+
+#include "vncimageregionbenchmark.moc"
@@ -0,0 +1,166 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <QTest>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef __linux__
+// Unlike the glibc one, this tcp_info has the segment counters.
+#include <linux/tcp.h>
+#else
+#include <netinet/tcp.h>
+#endif
+
+// Sends bursts of key and pointer messages over a loopback TCP connection
+// with TCP_NODELAY, as the VNC thread does, either with one write per
+// message or with all of them in a single write like
+// VncClientThread::flushMessages(). Reports the write calls and the TCP
+// segments each way takes.
+class VncInputBatchingBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+    void send_data();
+    void send();
+
+private:
+    // Read everything sent so far, @p size bytes.
+    void drain(size_t size);
+    qint64 segmentsOut() const;
+
+    int m_client = -1;
+    int m_server = -1;
+};
+
+// sz_rfbKeyEventMsg and sz_rfbPointerEventMsg.
+static const size_t KEY_EVENT_SIZE = 8;
+static const size_t POINTER_EVENT_SIZE = 6;
+static const int BURSTS = 1000;
+
+void VncInputBatchingBenchmark::init()
+{
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    QVERIFY(listener >= 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    QVERIFY(bind(listener, reinterpret_cast<sockaddr *>(&address), length) == 0);
+    QVERIFY(listen(listener, 1) == 0);
+    QVERIFY(getsockname(listener, reinterpret_cast<sockaddr *>(&address), &length) == 0);
+
+    m_client = socket(AF_INET, SOCK_STREAM, 0);
+    QVERIFY(m_client >= 0);
+    QVERIFY(::connect(m_client, reinterpret_cast<sockaddr *>(&address), length) == 0);
+    m_server = accept(listener, nullptr, nullptr);
+    close(listener);
+    QVERIFY(m_server >= 0);
+
+    const int optval = 1;
+    QVERIFY(setsockopt(m_client, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) == 0);
+}
+
+void VncInputBatchingBenchmark::cleanup()
+{
+    if (m_client >= 0) {
+        close(m_client);
+    }
+    if (m_server >= 0) {
+        close(m_server);
+    }
+    m_client = m_server = -1;
+}
+
+void VncInputBatchingBenchmark::drain(size_t size)
+{
+    std::array<char, 65536> buffer;
+    while (size > 0) {
+        const ssize_t count = read(m_server, buffer.data(), qMin(size, buffer.size()));
+        if (count <= 0) {
+            QFAIL(strerror(errno));
+        }
+        size -= count;
+    }
+}
+
+qint64 VncInputBatchingBenchmark::segmentsOut() const
+{
+#ifdef __linux__
+    tcp_info info = {};
+    socklen_t length = sizeof(info);
+    if (getsockopt(m_client, IPPROTO_TCP, TCP_INFO, &info, &length) == 0 && length >= offsetof(tcp_info, tcpi_segs_out) + sizeof(info.tcpi_segs_out)) {
+        return info.tcpi_segs_out;
+    }
+#endif
+    return -1;
+}
+
+void VncInputBatchingBenchmark::send_data()
+{
+    QTest::addColumn<int>("pointerEvents");
+    QTest::addColumn<bool>("batched");
+    // A key press and release along with the pointer motion drained in the
+    // same loop iteration.
+    for (int pointerEvents : {0, 4, 16}) {
+        QTest::addRow("%d pointer events, one write per message", pointerEvents) << pointerEvents << false;
+        QTest::addRow("%d pointer events, batched", pointerEvents) << pointerEvents << true;
+    }
+}
+
+void VncInputBatchingBenchmark::send()
+{
+    QFETCH(int, pointerEvents);
+    QFETCH(bool, batched);
+
+    std::vector<size_t> messages(2, KEY_EVENT_SIZE);
+    messages.insert(messages.end(), pointerEvents, POINTER_EVENT_SIZE);
+    std::array<char, 4096> batch = {};
+    size_t batchSize = 0;
+    for (size_t size : messages) {
+        batchSize += size;
+    }
+
+    qint64 writes = 0;
+    const qint64 segmentsBefore = segmentsOut();
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < BURSTS; ++i) {
+            if (batched) {
+                QCOMPARE(write(m_client, batch.data(), batchSize), ssize_t(batchSize));
+                writes++;
+            } else {
+                for (size_t size : messages) {
+                    QCOMPARE(write(m_client, batch.data(), size), ssize_t(size));
+                    writes++;
+                }
+            }
+            drain(batchSize);
+        }
+    }
+    const qint64 segmentsAfter = segmentsOut();
+
+    qInfo("%d bursts of %zu messages: %lld writes, %lld TCP segments",
+          BURSTS,
+          messages.size(),
+          writes,
+          segmentsBefore >= 0 ? segmentsAfter - segmentsBefore : -1);
+    QCOMPARE(writes, batched ? qint64(BURSTS) : qint64(BURSTS * messages.size()));
+}
+
+QTEST_GUILESS_MAIN(VncInputBatchingBenchmark)
+
+#include "vncinputbatchingbenchmark.moc"
@@ -0,0 +1,127 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "vncpixelconversion.h"
+#include "testimages.h"
+
+#include <QImage>
+#include <QTest>
+
+// Compares the conversion kernels used for 8 and 16 bit framebuffers with
+// QImage::convertToFormat(), which is what painting such a framebuffer
+// costs otherwise.
+class VncPixelConversionBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void rgb16_data();
+    void rgb16();
+    void rgb16Qt_data();
+    void rgb16Qt();
+    void rgb332_data();
+    void rgb332();
+    void rgb332Qt_data();
+    void rgb332Qt();
+
+private:
+    void addSizes();
+};
+
+// Same table as VncClientThread::setClientColorDepth().
+static QVector<QRgb> rgb332ColorTable()
+{
+    QVector<QRgb> table(256);
+    for (int i = 0; i < 256; ++i) {
+        table[i] = qRgb((i & 0x07) << 5, (i & 0x38) << 2, i & 0xc0);
+    }
+    return table;
+}
+
+void VncPixelConversionBenchmark::addSizes()
+{
+    QTest::addColumn<QSize>("size");
+    QTest::newRow("1080p") << QSize(1920, 1080);
+    QTest::newRow("4K") << QSize(3840, 2160);
+}
+
+void VncPixelConversionBenchmark::rgb16_data()
+{
+    addSizes();
+}
+
+void VncPixelConversionBenchmark::rgb16()
+{
+    QFETCH(QSize, size);
+    const QImage source = randomImage(size, QImage::Format_RGB16);
+    QImage converted(size, QImage::Format_RGB32);
+
+    QBENCHMARK {
+        for (int y = 0; y < size.height(); ++y) {
+            convertRgb16ToRgb32(reinterpret_cast<const quint16 *>(source.constScanLine(y)), reinterpret_cast<quint32 *>(converted.scanLine(y)), size.width());
+        }
+    }
+
+    QCOMPARE(converted, source.convertToFormat(QImage::Format_RGB32));
+}
+
+void VncPixelConversionBenchmark::rgb16Qt_data()
+{
+    addSizes();
+}
+
+void VncPixelConversionBenchmark::rgb16Qt()
+{
+    QFETCH(QSize, size);
+    const QImage source = randomImage(size, QImage::Format_RGB16);
+
+    QBENCHMARK {
+        const QImage converted = source.convertToFormat(QImage::Format_RGB32);
+        Q_UNUSED(converted);
+    }
+}
+
+void VncPixelConversionBenchmark::rgb332_data()
+{
+    addSizes();
+}
+
+void VncPixelConversionBenchmark::rgb332()
+{
+    QFETCH(QSize, size);
+    QImage source = randomImage(size, QImage::Format_Indexed8);
+    source.setColorTable(rgb332ColorTable());
+    QImage converted(size, QImage::Format_RGB32);
+
+    QBENCHMARK {
+        for (int y = 0; y < size.height(); ++y) {
+            convertRgb332ToRgb32(source.constScanLine(y), reinterpret_cast<quint32 *>(converted.scanLine(y)), size.width());
+        }
+    }
+
+    QCOMPARE(converted, source.convertToFormat(QImage::Format_RGB32));
+}
+
+void VncPixelConversionBenchmark::rgb332Qt_data()
+{
+    addSizes();
+}
+
+void VncPixelConversionBenchmark::rgb332Qt()
+{
+    QFETCH(QSize, size);
+    QImage source = randomImage(size, QImage::Format_Indexed8);
+    source.setColorTable(rgb332ColorTable());
+
+    QBENCHMARK {
+        const QImage converted = source.convertToFormat(QImage::Format_RGB32);
+        Q_UNUSED(converted);
+    }
+}
+
+QTEST_GUILESS_MAIN(VncPixelConversionBenchmark)
+
+#include "vncpixelconversionbenchmark.moc"
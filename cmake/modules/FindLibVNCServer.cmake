@@ -35,6 +35,43 @@ int main()
     CHECK_CXX_SOURCE_COMPILES("${_TEST_SOURCE_CODE}" LIBVNCSERVER_FOUND)
 ENDIF (LIBVNCSERVER_INCLUDE_DIR AND LIBVNCSERVER_LIBRARIES)
 
+# Optional libvncclient features: SendExtDesktopSize() is only available
+# since LibVNCServer 0.9.14, the ReadFromSocket hook in later versions.
+IF (LIBVNCSERVER_FOUND AND LIBVNCCLIENT_INCLUDE_DIR AND LIBVNCCLIENT_LIBRARIES)
+   SET(CMAKE_REQUIRED_INCLUDES "${LIBVNCCLIENT_INCLUDE_DIR}" "${CMAKE_REQUIRED_INCLUDES}")
+   SET(_SAVED_REQUIRED_LIBRARIES "${CMAKE_REQUIRED_LIBRARIES}")
+   SET(CMAKE_REQUIRED_LIBRARIES "${LIBVNCCLIENT_LIBRARIES}")
+   SET(_TEST_SOURCE_CODE "
+#include <rfb/rfbclient.h>
+
+int main()
+{
+    rfbClient* tmp = rfbGetClient(8, 3, 4);
+    return SendExtDesktopSize(tmp, 1024, 768) ? 0 : 1;
+}
+    ")
+   CHECK_CXX_SOURCE_COMPILES("${_TEST_SOURCE_CODE}" LIBVNCCLIENT_HAS_EXTDESKTOPSIZE)
+
+   # Hook replacing the reads from the socket.
+   SET(_TEST_SOURCE_CODE "
+#include <rfb/rfbclient.h>
+
+static int readHook(rfbClient*, char*, unsigned int)
+{
+    return 0;
+}
+
+int main()
+{
+    rfbClient* tmp = rfbGetClient(8, 3, 4);
+    tmp->ReadFromSocket = readHook;
+    return 0;
+}
+    ")
+   CHECK_CXX_SOURCE_COMPILES("${_TEST_SOURCE_CODE}" LIBVNCCLIENT_HAS_READ_HOOK)
+   SET(CMAKE_REQUIRED_LIBRARIES "${_SAVED_REQUIRED_LIBRARIES}")
+ENDIF (LIBVNCSERVER_FOUND AND LIBVNCCLIENT_INCLUDE_DIR AND LIBVNCCLIENT_LIBRARIES)
+
 IF (LIBVNCSERVER_FOUND)
   IF (NOT LIBVNCSERVER_FIND_QUIETLY)
     MESSAGE(STATUS "Found LibVNCServer: ${LIBVNCSERVER_LIBRARIES}")
@@ -22,6 +22,7 @@ RemoteView::RemoteView(QWidget *parent)
     , m_scale(false)
     , m_keyboardIsGrabbed(false)
     , m_factor(0.)
+    , m_updatesPaused(false)
 #ifndef QTONLY
     , m_wallet(nullptr)
 #endif
@@ -183,6 +184,16 @@ void RemoteView::scaleResize(int, int)
 {
 }
 
+void RemoteView::setUpdatesPaused(bool paused)
+{
+    m_updatesPaused = paused;
+}
+
+bool RemoteView::updatesPaused() const
+{
+    return m_updatesPaused;
+}
+
 QUrl RemoteView::url()
 {
     return m_url;
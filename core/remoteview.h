@@ -256,6 +256,12 @@ public:
      */
     QUrl url();
 
+    /**
+     * @return true if remote updates are paused
+     * @see setUpdatesPaused()
+     */
+    bool updatesPaused() const;
+
 public Q_SLOTS:
     /**
      * Called to enable or disable scaling.
@@ -318,6 +324,17 @@ public Q_SLOTS:
      */
     virtual void scaleResize(int w, int h);
 
+    /**
+     * Called when the view can not be seen, e.g. because its tab is not the
+     * current one or the window is minimized, and when it can be seen again.
+     * While paused, the view should not make the server send updates; when
+     * resumed, it should ask for the whole screen again.
+     * The default implementation only stores the state.
+     * @param paused true to pause, false to resume.
+     * @see updatesPaused()
+     */
+    virtual void setUpdatesPaused(bool paused);
+
 Q_SIGNALS:
     /**
      * Emitted when the size of the remote screen changes. Also
@@ -347,6 +364,12 @@ Q_SIGNALS:
      */
     void errorMessage(const QString &title, const QString &message);
 
+    /**
+     * Emitted with an informational message about the session, e.g. a
+     * change of encoding, meant for the status bar.
+     */
+    void statusMessage(const QString &message);
+
     /**
      * Emitted when the status of the view changed.
      * @param s the new status
@@ -403,6 +426,7 @@ protected:
     bool m_keyboardIsGrabbed;
     QUrl m_url;
     qreal m_factor;
+    bool m_updatesPaused;
 
 #ifndef QTONLY
     QString readWalletPassword(bool fromUserNameOnly = false);
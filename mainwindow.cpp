@@ -64,6 +64,7 @@
 #include <QTimer>
 #include <QToolBar>
 #include <QVBoxLayout>
+#include <QWindow>
 
 MainWindow::MainWindow(QWidget *parent)
     : KXmlGuiWindow(parent)
@@ -120,6 +121,9 @@ MainWindow::MainWindow(QWidget *parent)
 
     connect(m_tabWidget, SIGNAL(currentChanged(int)), SLOT(tabChanged(int)));
 
+    // to pause the remote views while the window is hidden or minimized
+    installEventFilter(this);
+
     if (Settings::showStatusBar())
         statusBar()->showMessage(i18n("KDE Remote Desktop Client started"));
 
@@ -302,6 +306,7 @@ void MainWindow::newConnection(const QUrl &newUrl, bool switchFullscreenWhenConn
 
     connect(view, SIGNAL(framebufferSizeChanged(int, int)), this, SLOT(resizeTabWidget(int, int)));
     connect(view, SIGNAL(statusChanged(RemoteView::RemoteStatus)), this, SLOT(statusChanged(RemoteView::RemoteStatus)));
+    connect(view, SIGNAL(statusMessage(QString)), this, SLOT(showStatusMessage(QString)));
     connect(view, SIGNAL(disconnected()), this, SLOT(disconnectHost()));
 
     QScrollArea *scrollArea = createScrollArea(m_tabWidget, view);
@@ -454,6 +459,16 @@ void MainWindow::statusChanged(RemoteView::RemoteStatus status)
         statusBar()->showMessage(message);
 }
 
+void MainWindow::showStatusMessage(const QString &message)
+{
+    // only tell about the session the user is looking at
+    if (QObject::sender() != currentRemoteView())
+        return;
+
+    if (Settings::showStatusBar())
+        statusBar()->showMessage(message, 5000);
+}
+
 void MainWindow::takeScreenshot()
 {
     const QPixmap snapshot = currentRemoteView()->takeScreenshot();
@@ -1020,6 +1035,20 @@ bool MainWindow::eventFilter(QObject *obj, QEvent *event)
     if (obj == m_fullscreenWindow && event->type() == QEvent::Close) {
         quit(true);
     }
+
+    // the window showing the remote views may have been hidden, minimized or
+    // covered, or shown again. Check once the event has been handled.
+    switch (event->type()) {
+    case QEvent::Show:
+    case QEvent::Hide:
+    case QEvent::WindowStateChange:
+    case QEvent::Expose:
+        QMetaObject::invokeMethod(this, "updatePausedViews", Qt::QueuedConnection);
+        break;
+    default:
+        break;
+    }
+
     // allow other events to pass through.
     return QObject::eventFilter(obj, event);
 }
@@ -1083,6 +1112,30 @@ void MainWindow::tabChanged(int index)
     setCaption(tabTitle == i18n("New Connection") ? QString() : tabTitle);
 
     updateActionStatus();
+    updatePausedViews();
+}
+
+void MainWindow::updatePausedViews()
+{
+    QWidget *window = m_tabWidget->window();
+    QWindow *windowHandle = window->windowHandle();
+    if (windowHandle) {
+        // the window system tells about a covered window on the QWindow only
+        windowHandle->installEventFilter(this);
+    }
+
+    const bool windowVisible = window->isVisible() && !window->isMinimized() && (!windowHandle || windowHandle->isExposed());
+    RemoteView *current = currentRemoteView();
+
+    // Only the current view of a visible window can be seen, the others
+    // do not need to receive and draw remote updates.
+    for (RemoteView *view : qAsConst(m_remoteViewMap)) {
+        const bool paused = !windowVisible || view != current;
+        if (paused != view->updatesPaused()) {
+            qCDebug(KRDC) << (paused ? "Pausing" : "Resuming") << "updates of" << view->host();
+            view->setUpdatesPaused(paused);
+        }
+    }
 }
 
 QWidget *MainWindow::newConnectionWidget()
@@ -65,6 +65,8 @@ private Q_SLOTS:
     void showMenubar();
     void resizeTabWidget(int w, int h);
     void statusChanged(RemoteView::RemoteStatus status);
+    void showStatusMessage(const QString &message);
+    void updatePausedViews();
     void showRemoteViewToolbar();
     void takeScreenshot();
     void switchFullscreen();
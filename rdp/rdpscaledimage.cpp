@@ -0,0 +1,82 @@
+/*
+ * SPDX-FileCopyrightText: 2026 KRDC developers
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "rdpscaledimage.h"
+
+#include <QPainter>
+
+// Smooth scaling blends neighbouring pixels, so a change also affects a
+// pixel around it once scaled.
+static QRect scaledRect(const QTransform &transform, const QRect &rect)
+{
+    return transform.mapRect(QRectF(rect)).toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+QTransform RdpScaledImage::transform(const QSize &sourceSize, const QSize &size)
+{
+    const QSize scaledSize = sourceSize.scaled(size, Qt::KeepAspectRatio);
+    return QTransform::fromScale(qreal(scaledSize.width()) / sourceSize.width(), qreal(scaledSize.height()) / sourceSize.height());
+}
+
+QRegion RdpScaledImage::scaledDamage(const QRegion &damage, const QSize &sourceSize, const QSize &size)
+{
+    if (sourceSize.isEmpty()) {
+        return QRegion();
+    }
+
+    const QTransform scale = transform(sourceSize, size);
+    QRegion scaled;
+    for (const QRect &rect : damage) {
+        scaled += scaledRect(scale, rect);
+    }
+    return scaled;
+}
+
+void RdpScaledImage::update(const QImage &source, const QSize &size, const QRegion &damage)
+{
+    const QSize scaledSize = source.size().scaled(size, Qt::KeepAspectRatio);
+    if (scaledSize.isEmpty()) {
+        return;
+    }
+
+    QRegion changed = damage;
+    if (m_image.size() != scaledSize || m_sourceSize != source.size()) {
+        m_image = QImage(scaledSize, source.format());
+        m_sourceSize = source.size();
+        changed = source.rect();
+    }
+    if (changed.isEmpty()) {
+        return;
+    }
+
+    // Everything goes through the same transformation, so that areas scaled
+    // at different times match up.
+    const QTransform scale = transform(source.size(), size);
+    const QTransform inverse = scale.inverted();
+
+    QPainter painter(&m_image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    for (const QRect &rect : changed) {
+        // Read a bit more of the source than needed, so that the edges of
+        // the source rectangle stay outside the clip.
+        const QRect target = scaledRect(scale, rect).intersected(m_image.rect());
+        const QRect sourceRect = inverse.mapRect(QRectF(target)).toAlignedRect().adjusted(-2, -2, 2, 2).intersected(source.rect());
+
+        painter.setClipRect(target);
+        painter.drawImage(scale.mapRect(QRectF(sourceRect)), source, sourceRect);
+    }
+}
+
+void RdpScaledImage::clear()
+{
+    m_image = QImage();
+    m_sourceSize = QSize();
+}
+
+const QImage &RdpScaledImage::image() const
+{
+    return m_image;
+}
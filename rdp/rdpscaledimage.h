@@ -0,0 +1,48 @@
+/*
+ * SPDX-FileCopyrightText: 2026 KRDC developers
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <QImage>
+#include <QRegion>
+#include <QSize>
+#include <QTransform>
+
+/**
+ * A copy of an image scaled to fit a size, keeping its aspect ratio, which
+ * is kept up to date by scaling only the areas of the image that changed.
+ */
+class RdpScaledImage
+{
+public:
+    /**
+     * The transformation fitting an image of @p sourceSize into @p size.
+     */
+    static QTransform transform(const QSize &sourceSize, const QSize &size);
+
+    /**
+     * The area of the scaled image that changes with @p damage, an area of
+     * an image of @p sourceSize fitted into @p size.
+     */
+    static QRegion scaledDamage(const QRegion &damage, const QSize &sourceSize, const QSize &size);
+
+    /**
+     * Bring the scaled image up to date with @p source fitted into
+     * @p size, where only @p damage changed since the last update. All of
+     * it is scaled again if the sizes changed.
+     */
+    void update(const QImage &source, const QSize &size, const QRegion &damage);
+
+    /**
+     * Drop the scaled image, the next update() scales all of the source.
+     */
+    void clear();
+
+    const QImage &image() const;
+
+private:
+    QImage m_image;
+    QSize m_sourceSize;
+};
@@ -5,10 +5,16 @@
 
 #include "rdpsession.h"
 
+#include <chrono>
+#include <cstring>
+#include <future>
 #include <memory>
+#include <utility>
 
+#include <QElapsedTimer>
 #include <QKeyEvent>
 #include <QMouseEvent>
+#include <QPointer>
 
 #include <KLocalizedString>
 #include <KMessageBox>
@@ -159,7 +165,14 @@ int logonErrorInfo(freerdp *rdp, UINT32 data, UINT32 type)
     if (type == LOGON_MSG_SESSION_CONTINUE)
         return 0;
 
-    KMessageBox::error(nullptr, typeString + QStringLiteral(" ") + dataString, i18nc("@title:dialog", "Logon Error"));
+    // Called on the session thread.
+    auto session = reinterpret_cast<RdpContext *>(rdp->context)->session;
+    QMetaObject::invokeMethod(
+        session,
+        [typeString, dataString]() {
+            KMessageBox::error(nullptr, typeString + QStringLiteral(" ") + dataString, i18nc("@title:dialog", "Logon Error"));
+        },
+        Qt::QueuedConnection);
 
     return 1;
 }
@@ -287,11 +300,13 @@ void RdpSession::setHostPreferences(RdpHostPreferences *preferences)
 
 QSize RdpSession::size() const
 {
+    std::lock_guard lock(m_frameMutex);
     return m_size;
 }
 
 void RdpSession::setSize(QSize size)
 {
+    std::lock_guard lock(m_frameMutex);
     m_size = size;
 }
 
@@ -435,9 +450,9 @@ bool RdpSession::start()
         break;
     }
 
-    if (!freerdp_connect(m_freerdp)) {
-        qWarning(KRDC) << "Unable to connect";
-        emitErrorMessage();
+    m_wakeupEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    if (!m_wakeupEvent) {
+        qCWarning(KRDC) << "Could not create the RDP session wakeup event";
         return false;
     }
 
@@ -450,10 +465,18 @@ bool RdpSession::start()
 void RdpSession::stop()
 {
     freerdp_abort_connect(m_freerdp);
+    if (m_wakeupEvent) {
+        SetEvent(m_wakeupEvent);
+    }
     if (m_thread.joinable()) {
         m_thread.join();
     }
 
+    if (m_wakeupEvent) {
+        CloseHandle(m_wakeupEvent);
+        m_wakeupEvent = nullptr;
+    }
+
     if (m_freerdp) {
         freerdp_context_free(m_freerdp);
         freerdp_free(m_freerdp);
@@ -463,13 +486,25 @@ void RdpSession::stop()
     }
 }
 
-const QImage *RdpSession::videoBuffer() const
+QImage RdpSession::videoBuffer() const
 {
-    return &m_videoBuffer;
+    std::lock_guard lock(m_frameMutex);
+    return m_frontBuffer;
+}
+
+QRegion RdpSession::takeDamage()
+{
+    std::lock_guard lock(m_frameMutex);
+    return std::exchange(m_damage, QRegion());
 }
 
 bool RdpSession::sendEvent(QEvent *event, QWidget *source)
 {
+    // Still connecting.
+    if (m_state != State::Running) {
+        return false;
+    }
+
     auto input = m_freerdp->context->input;
 
     switch (event->type()) {
@@ -487,9 +522,10 @@ bool RdpSession::sendEvent(QEvent *event, QWidget *source)
         auto mouseEvent = static_cast<QMouseEvent *>(event);
         auto position = mouseEvent->localPos();
         auto sourceSize = QSizeF{source->size()};
+        auto sessionSize = size();
 
-        auto x = (position.x() / sourceSize.width()) * m_size.width();
-        auto y = (position.y() / sourceSize.height()) * m_size.height();
+        auto x = (position.x() / sourceSize.width()) * sessionSize.width();
+        auto y = (position.y() / sourceSize.height()) * sessionSize.height();
 
         bool extendedEvent = false;
         UINT16 flags = 0;
@@ -562,9 +598,10 @@ bool RdpSession::sendEvent(QEvent *event, QWidget *source)
 
         auto position = wheelEvent->position();
         auto sourceSize = QSizeF{source->size()};
+        auto sessionSize = size();
 
-        auto x = (position.x() / sourceSize.width()) * m_size.width();
-        auto y = (position.y() / sourceSize.height()) * m_size.height();
+        auto x = (position.x() / sourceSize.width()) * sessionSize.width();
+        auto y = (position.y() / sourceSize.height()) * sessionSize.height();
 
         freerdp_input_send_mouse_event(input, flags, uint16_t(x), uint16_t(y));
     }
@@ -575,16 +612,84 @@ bool RdpSession::sendEvent(QEvent *event, QWidget *source)
     return QObject::event(event);
 }
 
+void RdpSession::setUpdatesPaused(bool paused)
+{
+    if (paused == m_updatesPaused) {
+        return;
+    }
+    m_updatesPaused = paused;
+
+    // The session thread sends it, once connected.
+    if (m_wakeupEvent) {
+        SetEvent(m_wakeupEvent);
+    }
+}
+
+void RdpSession::applyUpdatesPaused()
+{
+    const bool paused = m_updatesPaused;
+    if (paused == m_outputSuppressed) {
+        return;
+    }
+    m_outputSuppressed = paused;
+
+    auto context = m_freerdp->context;
+    auto update = context->update;
+    // The update functions check themselves whether the server supports
+    // these PDUs.
+    const QSize desktopSize = size();
+    const RECTANGLE_16 area{0, 0, UINT16(desktopSize.width()), UINT16(desktopSize.height())};
+
+    if (paused) {
+        m_pauseTimer.start();
+        update->SuppressOutput(context, FALSE, nullptr);
+        return;
+    }
+
+    if (m_pauseTimer.isValid()) {
+        qCDebug(KRDC) << "Updates resumed after" << m_pauseTimer.elapsed() << "ms";
+        m_pauseTimer.invalidate();
+    }
+    update->SuppressOutput(context, TRUE, &area);
+    // The server does not resend what changed while suppressed.
+    update->RefreshRect(context, 1, &area);
+}
+
 void RdpSession::setState(RdpSession::State newState)
 {
-    if (newState == m_state) {
+    if (m_state.exchange(newState) == newState) {
         return;
     }
 
-    m_state = newState;
     Q_EMIT stateChanged();
 }
 
+template<typename Function, typename Result>
+Result RdpSession::callOnGuiThread(Function function, Result cancelled)
+{
+    auto promise = std::make_shared<std::promise<Result>>();
+    auto abandoned = std::make_shared<std::atomic<bool>>(false);
+    auto future = promise->get_future();
+    QMetaObject::invokeMethod(
+        this,
+        [promise, abandoned, function, cancelled]() {
+            // Do not ask anything for a session that is going away.
+            promise->set_value(*abandoned ? cancelled : function());
+        },
+        Qt::QueuedConnection);
+
+    // stop() waits for this thread, maybe from a nested event loop of the
+    // very dialog we are waiting for, so give up once aborted. function may
+    // then still run or be running, so it must not use the session.
+    while (future.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+        if (freerdp_shall_disconnect(m_freerdp)) {
+            *abandoned = true;
+            return cancelled;
+        }
+    }
+    return future.get();
+}
+
 bool RdpSession::onPreConnect()
 {
     auto settings = m_freerdp->settings;
@@ -619,7 +724,12 @@ bool RdpSession::onPostConnect()
         return false;
     }
 
-    m_size = QSize(gdi->width, gdi->height);
+    {
+        std::lock_guard lock(m_frameMutex);
+        m_frontBuffer = m_videoBuffer.copy();
+        m_size = QSize(gdi->width, gdi->height);
+        m_damage = QRegion();
+    }
     Q_EMIT sizeChanged();
 
     m_freerdp->update->EndPaint = endPaint;
@@ -640,28 +750,46 @@ bool RdpSession::onAuthenticate(char **username, char **password, char **domain)
 {
     Q_UNUSED(domain);
 
-    std::unique_ptr<KPasswordDialog> dialog;
+    struct Credentials {
+        bool accepted = false;
+        QString username;
+        QString password;
+    };
+
     bool hasUsername = qstrlen(*username) != 0;
-    if (hasUsername) {
-        dialog = std::make_unique<KPasswordDialog>(nullptr, KPasswordDialog::ShowKeepPassword);
-        dialog->setPrompt(i18nc("@label", "Access to this system requires a password."));
-    } else {
-        dialog = std::make_unique<KPasswordDialog>(nullptr, KPasswordDialog::ShowUsernameLine | KPasswordDialog::ShowKeepPassword);
-        dialog->setPrompt(i18nc("@label", "Access to this system requires a username and password."));
-    }
+    QPointer<RdpView> view = m_view;
+    auto credentials = callOnGuiThread(
+        [view, hasUsername]() {
+            std::unique_ptr<KPasswordDialog> dialog;
+            if (hasUsername) {
+                dialog = std::make_unique<KPasswordDialog>(nullptr, KPasswordDialog::ShowKeepPassword);
+                dialog->setPrompt(i18nc("@label", "Access to this system requires a password."));
+            } else {
+                dialog = std::make_unique<KPasswordDialog>(nullptr, KPasswordDialog::ShowUsernameLine | KPasswordDialog::ShowKeepPassword);
+                dialog->setPrompt(i18nc("@label", "Access to this system requires a username and password."));
+            }
+
+            if (!dialog->exec()) {
+                return Credentials{};
+            }
+
+            // The view may be closed while the dialog is open.
+            if (dialog->keepPassword() && view) {
+                view->savePassword(dialog->password());
+            }
 
-    if (!dialog->exec()) {
+            return Credentials{true, dialog->username(), dialog->password()};
+        },
+        Credentials{});
+
+    if (!credentials.accepted) {
         return false;
     }
 
-    *password = qstrdup(dialog->password().toLocal8Bit().data());
+    *password = qstrdup(credentials.password.toLocal8Bit().data());
 
     if (!hasUsername) {
-        *username = qstrdup(dialog->username().toLocal8Bit().data());
-    }
-
-    if (dialog->keepPassword()) {
-        m_view->savePassword(dialog->password());
+        *username = qstrdup(credentials.username.toLocal8Bit().data());
     }
 
     return true;
@@ -669,48 +797,56 @@ bool RdpSession::onAuthenticate(char **username, char **password, char **domain)
 
 RdpSession::CertificateResult RdpSession::onVerifyCertificate(const Certificate &certificate)
 {
-    KMessageDialog dialog{KMessageDialog::QuestionTwoActions, i18nc("@label", "The certificate for this system is unknown. Do you wish to continue?")};
-    dialog.setCaption(i18nc("@title:dialog", "Verify Certificate"));
-    dialog.setIcon(QIcon::fromTheme(QStringLiteral("view-certficate")));
+    return callOnGuiThread(
+        [certificate]() {
+            KMessageDialog dialog{KMessageDialog::QuestionTwoActions, i18nc("@label", "The certificate for this system is unknown. Do you wish to continue?")};
+            dialog.setCaption(i18nc("@title:dialog", "Verify Certificate"));
+            dialog.setIcon(QIcon::fromTheme(QStringLiteral("view-certficate")));
 
-    dialog.setDetails(certificate.toString());
+            dialog.setDetails(certificate.toString());
 
-    dialog.setDontAskAgainText(i18nc("@label", "Remember this certificate"));
+            dialog.setDontAskAgainText(i18nc("@label", "Remember this certificate"));
 
-    dialog.setButtons(KStandardGuiItem::cont(), KStandardGuiItem::cancel());
+            dialog.setButtons(KStandardGuiItem::cont(), KStandardGuiItem::cancel());
 
-    if (!dialog.exec()) {
-        return CertificateResult::DoNotAccept;
-    }
+            if (!dialog.exec()) {
+                return CertificateResult::DoNotAccept;
+            }
 
-    if (dialog.isDontAskAgainChecked()) {
-        return CertificateResult::AcceptPermanently;
-    } else {
-        return CertificateResult::AcceptTemporarily;
-    }
+            if (dialog.isDontAskAgainChecked()) {
+                return CertificateResult::AcceptPermanently;
+            } else {
+                return CertificateResult::AcceptTemporarily;
+            }
+        },
+        CertificateResult::DoNotAccept);
 }
 
 RdpSession::CertificateResult RdpSession::onVerifyChangedCertificate(const Certificate &oldCertificate, const Certificate &newCertificate)
 {
-    KMessageDialog dialog{KMessageDialog::QuestionTwoActions, i18nc("@label", "The certificate for this system has changed. Do you wish to continue?")};
-    dialog.setCaption(i18nc("@title:dialog", "Certificate has Changed"));
-    dialog.setIcon(QIcon::fromTheme(QStringLiteral("view-certficate")));
+    return callOnGuiThread(
+        [oldCertificate, newCertificate]() {
+            KMessageDialog dialog{KMessageDialog::QuestionTwoActions, i18nc("@label", "The certificate for this system has changed. Do you wish to continue?")};
+            dialog.setCaption(i18nc("@title:dialog", "Certificate has Changed"));
+            dialog.setIcon(QIcon::fromTheme(QStringLiteral("view-certficate")));
 
-    dialog.setDetails(i18nc("@label", "Previous certificate:\n%1\nNew Certificate:\n%2", oldCertificate.toString(), newCertificate.toString()));
+            dialog.setDetails(i18nc("@label", "Previous certificate:\n%1\nNew Certificate:\n%2", oldCertificate.toString(), newCertificate.toString()));
 
-    dialog.setDontAskAgainText(i18nc("@label", "Remember this certificate"));
+            dialog.setDontAskAgainText(i18nc("@label", "Remember this certificate"));
 
-    dialog.setButtons(KStandardGuiItem::cont(), KStandardGuiItem::cancel());
+            dialog.setButtons(KStandardGuiItem::cont(), KStandardGuiItem::cancel());
 
-    if (!dialog.exec()) {
-        return CertificateResult::DoNotAccept;
-    }
+            if (!dialog.exec()) {
+                return CertificateResult::DoNotAccept;
+            }
 
-    if (dialog.isDontAskAgainChecked()) {
-        return CertificateResult::AcceptPermanently;
-    } else {
-        return CertificateResult::AcceptTemporarily;
-    }
+            if (dialog.isDontAskAgainChecked()) {
+                return CertificateResult::AcceptPermanently;
+            } else {
+                return CertificateResult::AcceptTemporarily;
+            }
+        },
+        CertificateResult::DoNotAccept);
 }
 
 bool RdpSession::onEndPaint()
@@ -724,13 +860,51 @@ bool RdpSession::onEndPaint()
         return false;
     }
 
-    auto invalid = gdi->primary->hdc->hwnd->invalid;
-    if (invalid->null) {
+    auto hwnd = gdi->primary->hdc->hwnd;
+    if (hwnd->invalid->null) {
         return true;
     }
 
-    auto rect = QRect{invalid->x, invalid->y, invalid->w, invalid->h};
-    Q_EMIT rectangleUpdated(rect);
+    // invalid is only the bounding rectangle of the rectangles in cinvalid.
+    QRegion damage;
+    for (int i = 0; i < hwnd->ninvalid; ++i) {
+        const auto &rect = hwnd->cinvalid[i];
+        damage += QRect{rect.x, rect.y, rect.w, rect.h};
+    }
+    if (damage.isEmpty()) {
+        damage = QRect{hwnd->invalid->x, hwnd->invalid->y, hwnd->invalid->w, hwnd->invalid->h};
+    }
+
+    // gdi_InvalidateRegion() keeps appending until the damage is reset,
+    // as FreeRDP's own EndPaint handlers do.
+    hwnd->invalid->null = TRUE;
+    hwnd->ninvalid = 0;
+
+    // GDI draws into m_videoBuffer, publish what changed to the front buffer
+    // read by the view. A copy of the front buffer the view still holds is
+    // detached by bits(), so the view never sees a frame half way.
+    std::unique_lock lock(m_frameMutex);
+    const int bytesPerPixel = m_videoBuffer.depth() / 8;
+    const auto bytesPerLine = m_frontBuffer.bytesPerLine();
+    uchar *front = m_frontBuffer.bits();
+    const uchar *back = m_videoBuffer.constBits();
+    for (const QRect &rect : damage) {
+        const QRect area = rect.intersected(m_frontBuffer.rect());
+        const auto offset = area.x() * bytesPerPixel;
+        for (int y = area.top(); y <= area.bottom(); ++y) {
+            memcpy(front + y * bytesPerLine + offset, back + y * bytesPerLine + offset, area.width() * bytesPerPixel);
+        }
+    }
+
+    // Only signal the first update until the view takes the damage, the
+    // following ones are painted along with it.
+    const bool wasEmpty = m_damage.isEmpty();
+    m_damage += damage;
+    lock.unlock();
+
+    if (wasEmpty) {
+        Q_EMIT videoBufferUpdated();
+    }
 
     return true;
 }
@@ -753,7 +927,13 @@ bool RdpSession::onResizeDisplay()
         return false;
     }
 
-    m_size = QSize(settings->DesktopWidth, settings->DesktopHeight);
+    {
+        // The view repaints everything after a resize.
+        std::lock_guard lock(m_frameMutex);
+        m_frontBuffer = m_videoBuffer.copy();
+        m_size = QSize(settings->DesktopWidth, settings->DesktopHeight);
+        m_damage = QRegion();
+    }
     Q_EMIT sizeChanged();
 
     return true;
@@ -761,31 +941,49 @@ bool RdpSession::onResizeDisplay()
 
 void RdpSession::run()
 {
-    auto rdpC = reinterpret_cast<rdpContext *>(m_context);
-
-    auto timer = CreateWaitableTimerA(nullptr, FALSE, "rdp-session-timer");
-    if (!timer) {
+    // Connecting resolves the host and goes through the TLS and NLA
+    // handshakes, which can take seconds, so it is done here rather than on
+    // the GUI thread.
+    if (!freerdp_connect(m_freerdp)) {
+        qCWarning(KRDC) << "Unable to connect";
+        emitErrorMessage();
+        setState(State::Closed);
         return;
     }
 
-    LARGE_INTEGER due;
-    due.QuadPart = 0;
-    if (!SetWaitableTimer(timer, &due, 1, nullptr, nullptr, false)) {
-        return;
-    }
+    auto rdpC = reinterpret_cast<rdpContext *>(m_context);
 
     setState(State::Running);
 
+    applyUpdatesPaused();
+
+    // Wakeups are counted to check that an idle session really sleeps.
+    QElapsedTimer timer;
+    timer.start();
+    quint64 wakeups = 0;
+
     HANDLE handles[MAXIMUM_WAIT_OBJECTS] = {};
     while (!freerdp_shall_disconnect(m_freerdp)) {
-        handles[0] = timer;
+        // Sleep until the server sends something or stop() or
+        // setUpdatesPaused() wake us up. Input is sent from the GUI thread
+        // directly and needs no wakeup.
+        handles[0] = m_wakeupEvent;
         auto count = freerdp_get_event_handles(rdpC, &handles[1], ARRAYSIZE(handles) - 1);
+        if (count == 0) {
+            emitErrorMessage();
+            break;
+        }
 
-        auto status = WaitForMultipleObjects(count, handles, FALSE, INFINITE);
+        auto status = WaitForMultipleObjects(count + 1, handles, FALSE, INFINITE);
         if (status == WAIT_FAILED) {
             emitErrorMessage();
             break;
         }
+        wakeups++;
+        if (status == WAIT_OBJECT_0) {
+            ResetEvent(m_wakeupEvent);
+            applyUpdatesPaused();
+        }
 
         if (freerdp_check_event_handles(rdpC) != TRUE) {
             emitErrorMessage();
@@ -793,6 +991,8 @@ void RdpSession::run()
         }
     }
 
+    qCDebug(KRDC) << "RDP session thread woke up" << wakeups << "times in" << timer.elapsed() / 1000.0 << "s";
+
     freerdp_disconnect(m_freerdp);
 }
 
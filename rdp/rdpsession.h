@@ -7,10 +7,13 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <thread>
 
+#include <QElapsedTimer>
 #include <QImage>
 #include <QObject>
+#include <QRegion>
 #include <QSize>
 
 #include <freerdp/freerdp.h>
@@ -95,9 +98,27 @@ public:
 
     bool sendEvent(QEvent *event, QWidget *source);
 
-    const QImage *videoBuffer() const;
+    /**
+     * Ask the server to stop sending display updates, using the Suppress
+     * Output PDU, or to resume them and refresh the whole screen.
+     */
+    void setUpdatesPaused(bool paused);
 
-    Q_SIGNAL void rectangleUpdated(const QRect &rectangle);
+    /**
+     * The last complete frame. Safe to call from any thread, and the image
+     * returned is not modified afterwards.
+     */
+    QImage videoBuffer() const;
+
+    /**
+     * The areas of the video buffer updated since the last call.
+     */
+    QRegion takeDamage();
+    /**
+     * Emitted from the session thread when areas of the video buffer were
+     * updated and no damage was waiting to be taken.
+     */
+    Q_SIGNAL void videoBufferUpdated();
 
     Q_SIGNAL void errorMessage(unsigned int error);
 
@@ -137,24 +158,48 @@ private:
     void run();
 
     void emitErrorMessage();
+    // Run function on the GUI thread from the session thread, for dialogs,
+    // and wait for its result. Returns cancelled if the session is stopped
+    // meanwhile, in which case function may run later or not at all: it
+    // must not capture the session.
+    template<typename Function, typename Result>
+    Result callOnGuiThread(Function function, Result cancelled);
+    // Send m_updatesPaused to the server if it changed, on the session
+    // thread.
+    void applyUpdatesPaused();
 
     RdpView *m_view;
 
     freerdp *m_freerdp = nullptr;
     RdpContext *m_context = nullptr;
 
-    State m_state = State::Initial;
+    std::atomic<State> m_state = State::Initial;
 
     QString m_user;
     QString m_domain;
     QString m_password;
     QString m_host;
     int m_port = -1;
-    QSize m_size;
 
     std::thread m_thread;
+    // Wakes the session thread up, to stop it or to pause updates.
+    HANDLE m_wakeupEvent = nullptr;
 
+    // Drawn into by GDI, only used by the session thread once connected.
     QImage m_videoBuffer;
 
+    // Protects the state shared with the GUI thread below.
+    mutable std::mutex m_frameMutex;
+    // Copy of m_videoBuffer as of the last EndPaint.
+    QImage m_frontBuffer;
+    QRegion m_damage;
+    QSize m_size;
+
+    // Set by the GUI thread, applied by the session thread, which alone uses
+    // the two members after it.
+    std::atomic<bool> m_updatesPaused = false;
+    bool m_outputSuppressed = false;
+    QElapsedTimer m_pauseTimer;
+
     RdpHostPreferences *m_preferences;
 };
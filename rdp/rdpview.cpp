@@ -22,6 +22,7 @@
 #include <QKeyEvent>
 #include <QMouseEvent>
 #include <QPainter>
+#include <QPointer>
 #include <QScreen>
 #include <QWindow>
 
@@ -129,7 +130,7 @@ bool RdpView::start()
         qCDebug(KRDC) << "freerdp resized rdp view" << sizeHint();
         Q_EMIT framebufferSizeChanged(width(), height());
     });
-    connect(m_session.get(), &RdpSession::rectangleUpdated, this, &RdpView::onRectangleUpdated);
+    connect(m_session.get(), &RdpSession::videoBufferUpdated, this, &RdpView::onVideoBufferUpdated);
     connect(m_session.get(), &RdpSession::stateChanged, this, [this]() {
         switch (m_session->state()) {
         case RdpSession::State::Starting:
@@ -142,6 +143,12 @@ bool RdpView::start()
             setStatus(Connected);
             break;
         case RdpSession::State::Closed:
+            // Connecting happens on the session thread, so a failure to
+            // connect is only reported here. handleError() quits itself once
+            // the error is shown, and this may run while it is.
+            if (status() != Connected && !m_showingError) {
+                startQuitting();
+            }
             setStatus(Disconnected);
             break;
         default:
@@ -231,7 +238,14 @@ void RdpView::handleError(const unsigned int error)
 
     qCDebug(KRDC) << "error message" << title << message;
     // TODO offer reconnect if approriate
+    QPointer<RdpView> self(this);
+    m_showingError = true;
     KMessageBox::error(this, message, title);
+    // The tab may have been closed from the message box's event loop.
+    if (!self) {
+        return;
+    }
+    m_showingError = false;
 
     // FIXME are there any situations we don't want to quit?
     startQuitting();
@@ -251,10 +265,20 @@ void RdpView::switchFullscreen(bool on)
     }
 }
 
+void RdpView::setUpdatesPaused(bool paused)
+{
+    RemoteView::setUpdatesPaused(paused);
+
+    if (m_session) {
+        m_session->setUpdatesPaused(paused);
+    }
+}
+
 QPixmap RdpView::takeScreenshot()
 {
-    if (!m_session->videoBuffer()->isNull()) {
-        return QPixmap::fromImage(*m_session->videoBuffer());
+    const QImage image = m_session->videoBuffer();
+    if (!image.isNull()) {
+        return QPixmap::fromImage(image);
     }
     return QPixmap{};
 }
@@ -273,6 +297,7 @@ void RdpView::enableScaling(bool scale)
 {
     m_hostPreferences->setScaleToSize(scale);
     qCDebug(KRDC) << "Scaling changed" << scale;
+    m_scaledImage.clear();
     resize(sizeHint());
     update();
 }
@@ -308,7 +333,9 @@ void RdpView::savePassword(const QString &password)
 
 void RdpView::paintEvent(QPaintEvent *event)
 {
-    if (m_session->videoBuffer()->isNull()) {
+    // A copy, which the session thread leaves alone while we paint it.
+    const QImage image = m_session->videoBuffer();
+    if (image.isNull()) {
         return;
     }
 
@@ -317,13 +344,14 @@ void RdpView::paintEvent(QPaintEvent *event)
     painter.begin(this);
     painter.setClipRect(event->rect());
 
-    auto image = *m_session->videoBuffer();
-
     if (m_hostPreferences->scaleToSize()) {
-        painter.drawImage(QPoint{0, 0}, image.scaled(size(), Qt::KeepAspectRatio, Qt::SmoothTransformation));
-    } else {
-        painter.drawImage(QPoint{0, 0}, image);
+        m_scaledImage.update(image, size(), m_pendingDamage);
+    }
+    const QImage &source = m_hostPreferences->scaleToSize() ? m_scaledImage.image() : image;
+    for (const QRect &rect : event->region()) {
+        painter.drawImage(rect, source, rect);
     }
+    m_pendingDamage = QRegion();
     painter.end();
 }
 
@@ -377,8 +405,18 @@ void RdpView::wheelEvent(QWheelEvent *event)
     event->accept();
 }
 
-void RdpView::onRectangleUpdated(const QRect &rect)
+void RdpView::onVideoBufferUpdated()
 {
-    m_pendingRectangle = rect;
-    update();
+    const QRegion damage = m_session->takeDamage();
+    if (damage.isEmpty()) {
+        return;
+    }
+    m_pendingDamage += damage;
+
+    if (!m_hostPreferences->scaleToSize()) {
+        update(damage);
+        return;
+    }
+
+    update(RdpScaledImage::scaledDamage(damage, m_session->size(), size()));
 }
@@ -12,8 +12,10 @@
 #include "remoteview.h"
 
 #include "rdphostpreferences.h"
+#include "rdpscaledimage.h"
 
 // #include <QProcess>
+#include <QRegion>
 #include <QUrl>
 
 #define TCP_PORT_RDP 3389
@@ -52,6 +54,7 @@ public:
     QPixmap takeScreenshot() override;
 
     void switchFullscreen(bool on) override;
+    void setUpdatesPaused(bool paused) override;
 
     void savePassword(const QString &password);
 
@@ -74,7 +77,7 @@ protected:
     void wheelEvent(QWheelEvent *event) override;
 
 private:
-    void onRectangleUpdated(const QRect &rect);
+    void onVideoBufferUpdated();
     void handleError(unsigned int error);
 
     QString m_name;
@@ -82,12 +85,17 @@ private:
     QString m_password;
     //
     bool m_quitting = false;
+    // handleError() is showing an error, and will quit afterwards.
+    bool m_showingError = false;
 
     std::unique_ptr<RdpHostPreferences> m_hostPreferences;
     std::unique_ptr<RdpSession> m_session;
 
-    QRect m_pendingRectangle;
-    QImage m_pendingData;
+    // Video buffer areas changed since the last paint.
+    QRegion m_pendingDamage;
+    // The video buffer scaled to the view, kept between paints so that only
+    // the changed areas need to be scaled again.
+    RdpScaledImage m_scaledImage;
 };
 
 #endif
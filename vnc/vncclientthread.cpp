@@ -6,21 +6,141 @@
 
 #include "vncclientthread.h"
 #include "krdc_debug.h"
+#include "vncpixelconversion.h"
 
 #include <QBitmap>
 #include <QCursor>
 #include <QMutexLocker>
 #include <QPixmap>
+#include <QRandomGenerator>
 #include <QTimer>
+#include <QtEndian>
 #include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <unistd.h>
+#include <vector>
 
 // for detecting intel AMT KVM vnc server
 static const QString INTEL_AMT_KVM_STRING = QLatin1String("Intel(r) AMT KVM");
 
+// Above this many rectangles, damage is merged before being repainted:
+// per-rectangle overhead then outweighs the pixels saved.
+static const int MAX_DAMAGE_RECTS = 16;
+static const int DAMAGE_TILE_SIZE = 64;
+
+// Delay before also trying the next address of the server, while the
+// previous attempts are still pending (Happy Eyeballs, RFC 8305).
+static const int CONNECTION_ATTEMPT_DELAY_MS = 250;
+// Give up on a connection attempt after this long.
+static const int CONNECT_TIMEOUT_MS = 15000;
+// Delays between reconnection attempts double between these bounds.
+static const int RECONNECT_MIN_DELAY_MS = 250;
+static const int RECONNECT_MAX_DELAY_MS = 8000;
+
+// Pixels kept up to date around the visible viewport, so that scrolling a
+// little does not show stale content.
+static const int VIEWPORT_MARGIN = 128;
+
+// After a key or pointer event, updates are requested without pacing for
+// this long, so that the remote desktop reacts as fast as it can.
+static const qint64 INTERACTIVE_NSECS = 500 * 1000 * 1000;
+
+// TigerVNC extensions, see the RFB community wiki.
+static const int ENCODING_FENCE = -312;
+static const int ENCODING_CONTINUOUS_UPDATES = -313;
+static const quint8 MSG_CONTINUOUS_UPDATES = 150; // End... from the server, Enable... to it
+static const quint8 MSG_FENCE = 248;
+static const quint32 FENCE_BLOCK_BEFORE = 1 << 0;
+static const quint32 FENCE_BLOCK_AFTER = 1 << 1;
+static const quint32 FENCE_SYNC_NEXT = 1 << 2;
+static const quint32 FENCE_REQUEST = 1u << 31;
+static const int FENCE_MAX_PAYLOAD = 64;
+
+// Number of distinct remote cursor shapes kept converted.
+static const int CURSOR_CACHE_SIZE = 32;
+
+// Large frame conversions use at most this many threads besides the VNC
+// thread.
+static const int MAX_CONVERSION_THREADS = 3;
+
+// Reduce the number of rectangles in region. Scattered damage is first
+// snapped to a tile grid, which lets neighbouring rectangles merge; if that
+// is still too fragmented, fall back to the bounding rectangle.
+static QRegion simplifyDamage(const QRegion &region)
+{
+    if (region.rectCount() <= MAX_DAMAGE_RECTS) {
+        return region;
+    }
+
+    QRegion tiled;
+    for (const QRect &rect : region) {
+        const int left = rect.left() / DAMAGE_TILE_SIZE * DAMAGE_TILE_SIZE;
+        const int top = rect.top() / DAMAGE_TILE_SIZE * DAMAGE_TILE_SIZE;
+        const int right = (rect.right() / DAMAGE_TILE_SIZE + 1) * DAMAGE_TILE_SIZE;
+        const int bottom = (rect.bottom() / DAMAGE_TILE_SIZE + 1) * DAMAGE_TILE_SIZE;
+        tiled += QRect(left, top, right - left, bottom - top);
+    }
+    // Tiles may stick out of the framebuffer, keep the damage inside it.
+    tiled &= region.boundingRect();
+
+    if (tiled.rectCount() <= MAX_DAMAGE_RECTS) {
+        return tiled;
+    }
+    return region.boundingRect();
+}
+
+// CPU time consumed by the calling thread, in nanoseconds.
+static qint64 threadCpuNsecs()
+{
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) {
+        return 0;
+    }
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Round trip time of sock as smoothed by the kernel, in nanoseconds, or -1
+// if unknown. The time between an update request and its answer is no
+// measure of the link: the server holds incremental requests until
+// something changes.
+static qint64 socketRoundTripNsecs(int sock)
+{
+#ifdef TCP_INFO
+    tcp_info info;
+    socklen_t length = sizeof(info);
+    if (sock >= 0 && getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &length) == 0 && info.tcpi_rtt > 0) {
+        return qint64(info.tcpi_rtt) * 1000;
+    }
+#else
+    Q_UNUSED(sock);
+#endif
+    return -1;
+}
+
+// Identify a cursor shape by its geometry and its raw source and mask bytes.
+// Using the bytes themselves as cache key means a hash collision can never
+// return the wrong cursor; shapes are small enough for this to be cheap.
+static QByteArray cursorShapeKey(const rfbClient *cl, int xhot, int yhot, int width, int height, int bpp)
+{
+    const int header[] = {xhot, yhot, width, height, bpp};
+    const int sourceSize = width * height * bpp;
+    const int maskSize = width * height;
+
+    QByteArray key;
+    key.reserve(sizeof(header) + sourceSize + maskSize);
+    key.append(reinterpret_cast<const char *>(header), sizeof(header));
+    key.append(reinterpret_cast<const char *>(cl->rcSource), sourceSize);
+    key.append(reinterpret_cast<const char *>(cl->rcMask), maskSize);
+    return key;
+}
+
 // Dispatch from this static callback context to the member context.
 rfbBool VncClientThread::newclientStatic(rfbClient *cl)
 {
@@ -39,6 +159,15 @@ void VncClientThread::updatefbStaticPartial(rfbClient *cl, int x, int y, int w,
     return t->updatefbPartial(x, y, w, h);
 }
 
+// Dispatch from this static callback context to the member context.
+void VncClientThread::copyRectStatic(rfbClient *cl, int srcX, int srcY, int w, int h, int destX, int destY)
+{
+    VncClientThread *t = (VncClientThread *)rfbClientGetClientData(cl, nullptr);
+    Q_ASSERT(t);
+
+    t->copyRect(srcX, srcY, w, h, destX, destY);
+}
+
 // Dispatch from this static callback context to the member context.
 void VncClientThread::updateFbStaticFinished(rfbClient *cl)
 {
@@ -57,6 +186,31 @@ void VncClientThread::cuttextStatic(rfbClient *cl, const char *text, int textlen
     t->cuttext(text, textlen);
 }
 
+// Dispatch from this static callback context to the reader of the client.
+int VncClientThread::readFromSocketStatic(rfbClient *cl, char *buffer, unsigned int size)
+{
+    VncClientThread *t = (VncClientThread *)rfbClientGetClientData(cl, nullptr);
+    Q_ASSERT(t);
+
+    return t->m_socketReader.read(buffer, size);
+}
+
+// Dispatch from this static callback context to the member context.
+rfbBool VncClientThread::handleMessageStatic(rfbClient *cl, rfbServerToClientMsg *message)
+{
+    VncClientThread *t = (VncClientThread *)rfbClientGetClientData(cl, nullptr);
+    Q_ASSERT(t);
+
+    switch (message->type) {
+    case MSG_FENCE:
+        return t->handleFence();
+    case MSG_CONTINUOUS_UPDATES:
+        return t->handleEndOfContinuousUpdates();
+    default:
+        return FALSE;
+    }
+}
+
 // Dispatch from this static callback context to the member context.
 char *VncClientThread::passwdHandlerStatic(rfbClient *cl)
 {
@@ -92,6 +246,12 @@ void VncClientThread::cursorShapeHandlerStatic(rfbClient *cl, int xhot, int yhot
     VncClientThread *t = (VncClientThread *)rfbClientGetClientData(cl, nullptr);
     Q_ASSERT(t);
 
+    const QByteArray key = cursorShapeKey(cl, xhot, yhot, width, height, bpp);
+    if (const QCursor *cursor = t->m_cursorCache.object(key)) {
+        Q_EMIT t->gotCursor(*cursor);
+        return;
+    }
+
     // get cursor shape from remote cursor field
     // it's important to set stride for images, pictures in VNC are not always 32-bit aligned
     QImage cursorImg;
@@ -119,7 +279,9 @@ void VncClientThread::cursorShapeHandlerStatic(rfbClient *cl, int xhot, int yhot
     QPixmap cursorPixmap(QPixmap::fromImage(cursorImg));
     cursorPixmap.setMask(QBitmap::fromImage(alpha));
 
-    Q_EMIT t->gotCursor(QCursor{cursorPixmap, xhot, yhot});
+    const QCursor cursor(cursorPixmap, xhot, yhot);
+    t->m_cursorCache.insert(key, new QCursor(cursor));
+    Q_EMIT t->gotCursor(cursor);
 }
 
 void VncClientThread::setClientColorDepth(rfbClient *cl, VncClientThread::ColorDepth cd)
@@ -184,30 +346,43 @@ rfbBool VncClientThread::newclient()
     if (size <= 0) {
         return false;
     }
-    if (frameBuffer)
+    // When reconnecting to the same desktop, keep the old content: it stays
+    // on screen until the server has sent the new one, instead of a black
+    // frame.
+    const QSize frameBufferSize(width, height);
+    if (!frameBuffer || frameBufferSize != m_frameBufferSize || depth != m_frameBufferDepth) {
         delete[] frameBuffer; // do not leak if we get a new framebuffer size
-    frameBuffer = new uint8_t[size];
+        frameBuffer = new uint8_t[size];
+        memset(frameBuffer, '\0', size);
+        m_frameBufferSize = frameBufferSize;
+        m_frameBufferDepth = depth;
+    }
     cl->frameBuffer = frameBuffer;
-    memset(cl->frameBuffer, '\0', size);
-
-    switch (quality()) {
-    case RemoteView::High:
-        cl->appData.encodingsString = "copyrect zlib hextile raw";
-        cl->appData.compressLevel = 0;
-        cl->appData.qualityLevel = 9;
-        break;
-    case RemoteView::Medium:
-        cl->appData.encodingsString = "copyrect tight zrle ultra zlib hextile corre rre raw";
-        cl->appData.compressLevel = 5;
-        cl->appData.qualityLevel = 7;
-        break;
-    case RemoteView::Low:
-    case RemoteView::Unknown:
-    default:
-        // bpp8 and tight encoding is not supported in libvnc
-        cl->appData.encodingsString = "copyrect zrle ultra zlib hextile corre rre raw";
-        cl->appData.compressLevel = 9;
-        cl->appData.qualityLevel = 1;
+    // libvncclient asks for the whole new framebuffer, unless held back.
+    if (m_holdingUpdateRequests) {
+        m_fullUpdateDue = true;
+    }
+    // Desktop resizes are scaled too.
+    m_unscaledSize = frameBufferSize * m_serverScale;
+
+    // bpp8 and tight encoding is not supported in libvnc
+    m_encodingController.setAllowTight(colorDepth() != bpp8);
+    applyEncodingProfile();
+
+    // libvncclient resets the update rectangle to the whole framebuffer
+    // before calling us, keep following the viewport instead.
+    if (m_viewport.isValid()) {
+        const QRect rect = m_viewport.adjusted(-VIEWPORT_MARGIN, -VIEWPORT_MARGIN, VIEWPORT_MARGIN, VIEWPORT_MARGIN).intersected(QRect(0, 0, width, height));
+        if (!rect.isEmpty()) {
+            cl->updateRect.x = rect.x();
+            cl->updateRect.y = rect.y();
+            cl->updateRect.w = rect.width();
+            cl->updateRect.h = rect.height();
+        }
+    }
+    // The area of continuous updates has to follow.
+    if (m_continuousUpdates) {
+        enableContinuousUpdates(true);
     }
 
     SetFormatAndEncodings(cl);
@@ -219,7 +394,34 @@ void VncClientThread::updatefbPartial(int x, int y, int w, int h)
 {
     //    qCDebug(KRDC) << "updated client: x: " << x << ", y: " << y << ", w: " << w << ", h: " << h;
 
-    m_dirtyRect = m_dirtyRect.united(QRect(x, y, w, h));
+    const QRect rect(x, y, w, h);
+    if (rect == m_copyDestination) {
+        // Already accounted for by copyRect().
+        m_copyDestination = QRect();
+        return;
+    }
+    m_dirtyRegion += rect;
+    m_updatePixels += qint64(w) * h;
+}
+
+void VncClientThread::copyRect(int srcX, int srcY, int w, int h, int destX, int destY)
+{
+    m_defaultCopyRect(cl, srcX, srcY, w, h, destX, destY);
+
+    // The view can only move what it shows if the source did not change
+    // earlier in this update. Otherwise, let updatefbPartial() count the
+    // destination as damage.
+    const QRect source(srcX, srcY, w, h);
+    m_copyDestination = QRect();
+    if (w <= 0 || h <= 0 || m_dirtyRegion.intersects(source)) {
+        return;
+    }
+    FramebufferCopy copy;
+    copy.source = source;
+    copy.dx = destX - srcX;
+    copy.dy = destY - srcY;
+    m_updateCopies.append(copy);
+    m_copyDestination = QRect(destX, destY, w, h);
 }
 
 void VncClientThread::updatefbFinished()
@@ -248,14 +450,212 @@ void VncClientThread::updatefbFinished()
     }
 
     img.setDevicePixelRatio(m_devicePixelRatio);
-    setImage(img);
 
-    // Compute bounding rect.
-    QRect updateRect = m_dirtyRect;
-    m_dirtyRect = QRect();
+    const QRegion updateRegion = simplifyDamage(m_dirtyRegion);
+    m_dirtyRegion = QRegion();
+
+    //    qCDebug(KRDC) << Q_FUNC_INFO << updateRegion;
+    publishFrame(img, updateRegion, m_updateCopies);
+    m_framebufferUpdates++;
+    if (m_continuousUpdates) {
+        m_continuousFramebufferUpdates++;
+    }
+    m_updateCopies.clear();
+    m_copyDestination = QRect();
+
+    // The first update tells whether the server supports scaling.
+    updateServerScale();
+
+    const qint64 now = m_clock.nsecsElapsed();
+    VncEncodingController::Sample sample;
+    sample.wallNsecs = now - m_messageStart;
+    sample.cpuNsecs = threadCpuNsecs() - m_messageStartCpu;
+    sample.roundTripNsecs = socketRoundTripNsecs(cl->sock);
+    sample.pixels = m_updatePixels;
+    m_updatePixels = 0;
+    if (m_holdingUpdateRequests) {
+        // Left to sendPacedUpdateRequest().
+        m_updateRequestDue = true;
+    }
+
+    if (m_adaptiveEncoding && m_encodingController.addSample(sample, now)) {
+        applyEncodingProfile();
+        ClientEvent event;
+        event.type = ClientEvent::Reconfigure;
+        fireEvent(event);
+        const QLatin1String name(m_encodingController.profile().name);
+#ifdef QTONLY
+        Q_EMIT statusMessage(tr("Adjusted the encoding to the connection: %1").arg(name));
+#else
+        Q_EMIT statusMessage(i18n("Adjusted the encoding to the connection: %1", name));
+#endif
+    }
+}
+
+rfbBool VncClientThread::handleFence()
+{
+    // The message type was read already.
+    char header[8];
+    if (!ReadFromRFBServer(cl, header, sizeof(header))) {
+        return FALSE;
+    }
+    const quint32 flags = qFromBigEndian<quint32>(header + 3);
+    const int length = quint8(header[7]);
+    if (length > FENCE_MAX_PAYLOAD) {
+        rfbClientErr("Fence payload too large (%d bytes)\n", length);
+        return FALSE;
+    }
+    char payload[FENCE_MAX_PAYLOAD];
+    if (length > 0 && !ReadFromRFBServer(cl, payload, length)) {
+        return FALSE;
+    }
+
+    if (!m_serverFences) {
+        qCDebug(KRDC) << "The server supports fences";
+        m_serverFences = true;
+        enableContinuousUpdates(true);
+    }
+    if (!(flags & FENCE_REQUEST)) {
+        return TRUE;
+    }
+
+    // Messages are handled in order and this answer is sent right away, which
+    // satisfies all the flags we know.
+    const quint32 answerFlags = flags & (FENCE_BLOCK_BEFORE | FENCE_BLOCK_AFTER | FENCE_SYNC_NEXT);
+    char answer[9 + FENCE_MAX_PAYLOAD] = {};
+    answer[0] = char(MSG_FENCE);
+    qToBigEndian<quint32>(answerFlags, answer + 4);
+    answer[8] = char(length);
+    memcpy(answer + 9, payload, length);
+    queueMessage(answer, 9 + length);
+    m_fencesAnswered++;
+    return flushMessages() ? TRUE : FALSE;
+}
+
+rfbBool VncClientThread::handleEndOfContinuousUpdates()
+{
+    if (!m_serverContinuousUpdates) {
+        // The first one only tells that the server supports them.
+        qCDebug(KRDC) << "The server supports continuous updates";
+        m_serverContinuousUpdates = true;
+        enableContinuousUpdates(true);
+    } else if (m_pendingContinuousUpdatesEnds > 0) {
+        // Acknowledges one of our disables, which may have been followed by
+        // an enable already.
+        m_pendingContinuousUpdatesEnds--;
+    } else if (m_continuousUpdates) {
+        // The server turned them off on its own, fall back to requests.
+        // Update requests are held while handling a message, leave it to
+        // sendPacedUpdateRequest().
+        qCDebug(KRDC) << "The server stopped continuous updates";
+        m_continuousUpdates = false;
+        m_updateRequestDue = true;
+    }
+    return TRUE;
+}
+
+void VncClientThread::enableContinuousUpdates(bool enable)
+{
+    // Without fences, the server has no way to tell how much the link can
+    // take, stay with requests then.
+    if (!m_serverFences || !m_serverContinuousUpdates || (enable && m_paused)) {
+        return;
+    }
+    if (!enable && !m_continuousUpdates) {
+        return;
+    }
+
+    char message[10];
+    message[0] = char(MSG_CONTINUOUS_UPDATES);
+    message[1] = enable ? 1 : 0;
+    qToBigEndian<quint16>(cl->updateRect.x, message + 2);
+    qToBigEndian<quint16>(cl->updateRect.y, message + 4);
+    qToBigEndian<quint16>(cl->updateRect.w, message + 6);
+    qToBigEndian<quint16>(cl->updateRect.h, message + 8);
+    queueMessage(message, sizeof(message));
+    flushMessages();
+    if (!enable) {
+        // The server answers with an EndOfContinuousUpdates.
+        m_pendingContinuousUpdatesEnds++;
+    }
 
-    //    qCDebug(KRDC) << Q_FUNC_INFO << updateRect;
-    emitUpdated(updateRect.x(), updateRect.y(), updateRect.width(), updateRect.height());
+    if (enable != m_continuousUpdates) {
+        qCDebug(KRDC) << "Continuous updates" << (enable ? "enabled" : "disabled");
+    }
+    m_continuousUpdates = enable;
+}
+
+void VncClientThread::publishFrame(const QImage &frameBuffer, const QRegion &damage, const QVector<FramebufferCopy> &copies)
+{
+    QMutexLocker locker(&mutex);
+
+    QRegion converted;
+    if (m_image.size() != frameBuffer.size()) {
+        m_image = QImage(frameBuffer.size(), QImage::Format_RGB32);
+        m_pendingDamage = m_image.rect();
+        converted = m_image.rect();
+        m_pendingCopies.clear();
+        m_pendingCopiedRegion = QRegion();
+    } else {
+        // The GUI applies all pending copies before repainting the pending
+        // damage. A copy reading from damage of an earlier update the GUI
+        // has not taken yet would move stale pixels, repaint it instead.
+        QRegion copied;
+        for (const FramebufferCopy &copy : copies) {
+            const QRect destination = copy.source.translated(copy.dx, copy.dy);
+            if (m_pendingDamage.intersects(copy.source)) {
+                m_pendingDamage += destination;
+            } else {
+                m_pendingCopies.append(copy);
+                m_pendingCopiedRegion += destination;
+            }
+            copied += destination;
+        }
+        m_pendingDamage += damage;
+        converted = damage + copied;
+    }
+    convertImageRegion(m_image, frameBuffer, converted, &m_conversionPool);
+    m_image.setDevicePixelRatio(frameBuffer.devicePixelRatio());
+
+    // If the GUI has not taken the previous frame yet, it will pick up this
+    // one together with it: no need to queue another notification.
+    const bool notify = !m_updatePending;
+    m_updatePending = true;
+    locker.unlock();
+
+    if (notify) {
+        emitUpdated();
+    }
+}
+
+QRegion VncClientThread::takeFrame(QImage &frame, QVector<FramebufferCopy> *copies)
+{
+    QMutexLocker locker(&mutex);
+
+    QRegion damage = m_pendingDamage;
+    if (copies) {
+        copies->clear();
+    }
+    if (frame.size() != m_image.size() || frame.format() != m_image.format()) {
+        frame = m_image.copy();
+        damage = frame.rect();
+    } else {
+        // On the GUI thread: keep it to a plain copy, the pool is for the
+        // VNC thread.
+        copyImageRegion(frame, m_image, damage + m_pendingCopiedRegion);
+        if (copies) {
+            copies->swap(m_pendingCopies);
+        } else {
+            damage += m_pendingCopiedRegion;
+        }
+    }
+    frame.setDevicePixelRatio(m_image.devicePixelRatio());
+
+    m_pendingDamage = QRegion();
+    m_pendingCopies.clear();
+    m_pendingCopiedRegion = QRegion();
+    m_updatePending = false;
+    return damage;
 }
 
 void VncClientThread::cuttext(const char *text, int textlen)
@@ -345,19 +745,12 @@ void VncClientThread::outputHandler(const char *format, va_list args)
     // If we are not going to attempt a reconnection, at least tell the user
     // the connection went away.
     if (message.contains(QLatin1String("read ("))) {
-        // Don't show a dialog if a reconnection is needed. Never contemplate
-        // reconnection if we don't have a password.
 #ifdef QTONLY
         QString tmp = i18n("Disconnected: %1.", message.toStdString().c_str());
 #else
         QString tmp = i18n("Disconnected: %1.", message);
 #endif
-        if (m_keepalive.set && !m_password.isNull()) {
-            m_keepalive.failed = true;
-            clientStateChange(RemoteView::Disconnected, tmp);
-        } else {
-            outputErrorMessageString = tmp;
-        }
+        connectionLost(tmp);
     }
 
     // internal messages, not displayed to user
@@ -365,13 +758,60 @@ void VncClientThread::outputHandler(const char *format, va_list args)
         outputErrorMessageString = QLatin1String("INTERNAL:APPLE_VNC_COMPATIBILTY");
 }
 
+void VncClientThread::connectionLost(const QString &details)
+{
+    // Don't show a dialog if a reconnection is needed. Never contemplate
+    // reconnection if we don't have a password.
+    if (m_keepalive.set && !m_password.isNull()) {
+        m_keepalive.failed = true;
+        clientStateChange(RemoteView::Disconnected, details);
+    } else {
+        outputErrorMessageString = details;
+    }
+}
+
 VncClientThread::VncClientThread(QObject *parent)
     : QThread(parent)
     , frameBuffer(nullptr)
+    , m_updatePending(false)
     , cl(nullptr)
     , m_devicePixelRatio(1.0)
+    , m_socket(-1)
+    , m_coalescePointerMotion(true)
+    , m_lastButtonMask(0)
+    , m_sendBatchSize(0)
+    , m_sendBatchHasInput(false)
+    , m_writeFailed(false)
+    , m_cursorCache(CURSOR_CACHE_SIZE)
+    , m_defaultCopyRect(nullptr)
+    , m_frameBufferDepth(0)
+    , m_serverScaling(true)
+    , m_serverScale(1)
+    , m_updatesPaused(false)
+    , m_paused(false)
+    , m_pauseStart(0)
+    , m_totalPausedNsecs(0)
+    , m_framebufferUpdates(0)
+    , m_continuousFramebufferUpdates(0)
+    , m_fencesAnswered(0)
+    , m_updateRate(0)
+    , m_holdingUpdateRequests(false)
+    , m_updateRequestDue(false)
+    , m_fullUpdateDue(false)
+    , m_lastUpdateRequest(0)
+    , m_lastInput(0)
+    , m_serverFences(false)
+    , m_serverContinuousUpdates(false)
+    , m_continuousUpdates(false)
+    , m_pendingContinuousUpdatesEnds(0)
+    , m_adaptiveEncoding(true)
+    , m_messageStart(0)
+    , m_messageStartCpu(0)
+    , m_updatePixels(0)
     , m_stopped(false)
 {
+    m_conversionPool.setMaxThreadCount(qBound(1, QThread::idealThreadCount() - 1, MAX_CONVERSION_THREADS));
+
     // We choose a small value for interval...after all if the connection is
     // supposed to sustain a VNC session, a reasonably frequent ping should
     // be perfectly supportable.
@@ -383,6 +823,18 @@ VncClientThread::VncClientThread(QObject *parent)
     outputErrorMessageString.clear(); // don't deliver error messages of old instances...
     QMutexLocker locker(&mutex);
 
+    m_clock.start();
+
+    if (pipe(m_wakeupPipe) < 0) {
+        qCritical(KRDC) << "pipe()" << strerror(errno);
+        m_wakeupPipe[0] = m_wakeupPipe[1] = -1;
+    } else {
+        for (int fd : m_wakeupPipe) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+
     QTimer *outputErrorMessagesCheckTimer = new QTimer(this);
     outputErrorMessagesCheckTimer->setInterval(500);
     connect(outputErrorMessagesCheckTimer, SIGNAL(timeout()), this, SLOT(checkOutputErrorMessage()));
@@ -392,14 +844,23 @@ VncClientThread::VncClientThread(QObject *parent)
 VncClientThread::~VncClientThread()
 {
     if (isRunning()) {
+        // stop() interrupts waiting, connecting and reading from the server.
         stop();
-        terminate();
-        const bool quitSuccess = wait(1000);
-        qCDebug(KRDC) << "Attempting to stop in deconstructor, will crash if this fails:" << quitSuccess;
+        if (!wait(3000)) {
+            qCWarning(KRDC) << "VNC thread did not stop, terminating it";
+            terminate();
+            wait();
+        }
     }
 
     clientDestroy();
 
+    for (int fd : m_wakeupPipe) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
     delete[] frameBuffer;
 }
 
@@ -442,7 +903,39 @@ void VncClientThread::setShowLocalCursor(bool show)
     cl->appData.useRemoteCursor = show;
 
     // need to communicate this change to server or it won't stop painting cursor
-    m_eventQueue.enqueue(new ReconfigureEvent);
+    ClientEvent event;
+    event.type = ClientEvent::Reconfigure;
+    enqueueEvent(event);
+}
+
+void VncClientThread::setCoalescePointerMotion(bool coalesce)
+{
+    QMutexLocker locker(&mutex);
+    m_coalescePointerMotion = coalesce;
+}
+
+void VncClientThread::setAdaptiveEncoding(bool adaptive)
+{
+    QMutexLocker locker(&mutex);
+    m_adaptiveEncoding = adaptive;
+}
+
+void VncClientThread::setServerScaling(bool serverScaling)
+{
+    QMutexLocker locker(&mutex);
+    m_serverScaling = serverScaling;
+}
+
+void VncClientThread::setUpdateRate(int fps)
+{
+    QMutexLocker locker(&mutex);
+    m_updateRate = qMax(0, fps);
+}
+
+void VncClientThread::setUpdatesPaused(bool paused)
+{
+    m_updatesPaused = paused;
+    wakeup();
 }
 
 void VncClientThread::setQuality(RemoteView::Quality quality)
@@ -482,25 +975,106 @@ VncClientThread::ColorDepth VncClientThread::colorDepth() const
     return m_colorDepth;
 }
 
-void VncClientThread::setImage(const QImage &img)
+void VncClientThread::updateViewport()
 {
-    QMutexLocker locker(&mutex);
-    m_image = img;
+    const QRect frame(0, 0, cl->width, cl->height);
+    const QRect viewport = m_viewport.intersected(frame);
+    const QRect current(cl->updateRect.x, cl->updateRect.y, cl->updateRect.w, cl->updateRect.h);
+    const QRect wanted = viewport.adjusted(-VIEWPORT_MARGIN, -VIEWPORT_MARGIN, VIEWPORT_MARGIN, VIEWPORT_MARGIN).intersected(frame);
+    if (viewport.isEmpty() || wanted == current) {
+        return;
+    }
+    // Small scrolls stay within the margin: only move the update rectangle
+    // once the viewport leaves it, or if it got much larger than needed.
+    const qint64 currentArea = qint64(current.width()) * current.height();
+    const qint64 wantedArea = qint64(wanted.width()) * wanted.height();
+    if (current.contains(viewport) && currentArea <= 2 * wantedArea) {
+        return;
+    }
+
+    cl->updateRect.x = wanted.x();
+    cl->updateRect.y = wanted.y();
+    cl->updateRect.w = wanted.width();
+    cl->updateRect.h = wanted.height();
+
+    // The server did not keep us informed about areas outside the previous
+    // rectangle, ask for their full content.
+    for (const QRect &rect : QRegion(wanted) - current) {
+        SendFramebufferUpdateRequest(cl, rect.x(), rect.y(), rect.width(), rect.height(), FALSE);
+    }
+    if (m_continuousUpdates) {
+        enableContinuousUpdates(true);
+    }
 }
 
-const QImage VncClientThread::image(int x, int y, int w, int h)
+void VncClientThread::updateServerScale()
 {
-    QMutexLocker locker(&mutex);
+    if (!m_serverScaling || m_unscaledSize.isEmpty()) {
+        return;
+    }
+    if (!SupportsClient2Server(cl, rfbSetScale) && !SupportsClient2Server(cl, rfbPalmVNCSetScaleFactor)) {
+        // Not known before the server listed the messages it supports,
+        // along with its first update.
+        return;
+    }
+
+    // Only integer divisors are supported. Use the largest one that still
+    // gives at least as many pixels as displayed, the rest of the way is
+    // scaled locally.
+    int scale = 1;
+    if (m_scaleTarget.isValid() && !m_scaleTarget.isEmpty()) {
+        scale = qMax(1, qMin(m_unscaledSize.width() / m_scaleTarget.width(), m_unscaledSize.height() / m_scaleTarget.height()));
+    }
+    if (scale == m_serverScale) {
+        return;
+    }
+
+    flushMessages();
+    // The server answers with a framebuffer resize, see newclient(). It
+    // scales pointer events back itself.
+    SendScaleSetting(cl, scale);
+    m_serverScale = scale;
+    qCDebug(KRDC) << "Server side scale set to 1 /" << scale << "for" << m_unscaledSize << "displayed at" << m_scaleTarget;
+
+    if (scale > 1) {
+#ifdef QTONLY
+        Q_EMIT statusMessage(tr("The remote desktop is scaled down by the server (1:%1)").arg(scale));
+#else
+        Q_EMIT statusMessage(i18n("The remote desktop is scaled down by the server (1:%1)", scale));
+#endif
+    } else {
+#ifdef QTONLY
+        Q_EMIT statusMessage(tr("The remote desktop is scaled locally"));
+#else
+        Q_EMIT statusMessage(i18n("The remote desktop is scaled locally"));
+#endif
+    }
+}
 
-    if (w == 0) // full image requested
-        return m_image;
-    else
-        return m_image.copy(x, y, w, h);
+void VncClientThread::applyEncodingProfile()
+{
+    const VncEncodingController::Profile &profile = m_encodingController.profile();
+    cl->appData.encodingsString = profile.encodings;
+    cl->appData.compressLevel = profile.compressLevel;
+    cl->appData.qualityLevel = profile.qualityLevel;
 }
 
-void VncClientThread::emitUpdated(int x, int y, int w, int h)
+VncClientThread::InputStatistics VncClientThread::inputStatistics() const
 {
-    Q_EMIT imageUpdated(x, y, w, h);
+    InputStatistics stats;
+    stats.events = m_inputLatency.events;
+    stats.totalLatencyUsecs = m_inputLatency.totalUsecs;
+    stats.maxLatencyUsecs = m_inputLatency.maxUsecs;
+    stats.droppedEvents = m_inputLatency.dropped;
+    stats.coalescedPointerEvents = m_inputLatency.coalesced;
+    stats.messages = m_inputLatency.messages;
+    stats.writes = m_inputLatency.writes;
+    return stats;
+}
+
+void VncClientThread::emitUpdated()
+{
+    Q_EMIT imageUpdated();
 }
 
 void VncClientThread::emitGotCut(const QString &text)
@@ -512,6 +1086,283 @@ void VncClientThread::stop()
 {
     QMutexLocker locker(&mutex);
     m_stopped = true;
+    // Make a pending handshake or read fail right away.
+    if (m_socket >= 0) {
+        shutdown(m_socket, SHUT_RDWR);
+    }
+    wakeup();
+}
+
+void VncClientThread::enqueueEvent(ClientEvent event)
+{
+    event.queuedAt = m_clock.nsecsElapsed();
+    if (!m_eventRing.push(event)) {
+        // The VNC thread is not keeping up (e.g. it is reconnecting). Drop
+        // the event rather than blocking the GUI thread.
+        if (m_inputLatency.dropped++ == 0) {
+            qCWarning(KRDC) << "Client event queue full, dropping events";
+        }
+    }
+    wakeup();
+}
+
+bool VncClientThread::processEventQueue()
+{
+    while (const ClientEvent *event = m_eventRing.peek()) {
+        if (m_writeFailed) {
+            // Left for the next connection.
+            return false;
+        }
+        // When the server or link is slow, pointer motion piles up. A pure
+        // motion event (same buttons as the last one sent) followed by
+        // another one with the same buttons can be dropped: only the final
+        // position matters. Button transitions, including the press/release
+        // pairs generated for wheel ticks, are never merged.
+        if (m_coalescePointerMotion && event->type == ClientEvent::Pointer && event->buttonMask == m_lastButtonMask) {
+            const ClientEvent *next = m_eventRing.peek(1);
+            if (next && next->type == ClientEvent::Pointer && next->buttonMask == event->buttonMask) {
+                m_inputLatency.coalesced++;
+                m_eventRing.pop();
+                continue;
+            }
+        }
+
+        fireEvent(*event);
+
+        const quint64 latency = (m_clock.nsecsElapsed() - event->queuedAt) / 1000;
+        m_inputLatency.events++;
+        m_inputLatency.totalUsecs += latency;
+        if (latency > m_inputLatency.maxUsecs) {
+            m_inputLatency.maxUsecs = latency;
+        }
+
+        m_eventRing.pop();
+    }
+
+    return flushMessages();
+}
+
+void VncClientThread::fireEvent(const ClientEvent &event)
+{
+    switch (event.type) {
+    case ClientEvent::Key: {
+        m_lastInput = m_clock.nsecsElapsed();
+        if (!SupportsClient2Server(cl, rfbKeyEvent)) {
+            break;
+        }
+        rfbKeyEventMsg ke;
+        ke.type = rfbKeyEvent;
+        ke.down = event.pressed ? 1 : 0;
+        ke.pad = 0;
+        ke.key = qToBigEndian<quint32>(event.key);
+        queueMessage(&ke, sz_rfbKeyEventMsg);
+        m_sendBatchHasInput = true;
+        m_inputLatency.messages++;
+        break;
+    }
+    case ClientEvent::Pointer: {
+        m_lastInput = m_clock.nsecsElapsed();
+        m_lastButtonMask = event.buttonMask;
+        if (!SupportsClient2Server(cl, rfbPointerEvent)) {
+            break;
+        }
+        rfbPointerEventMsg pe;
+        pe.type = rfbPointerEvent;
+        pe.buttonMask = event.buttonMask;
+        pe.x = qToBigEndian<quint16>(qMax(event.x, 0));
+        pe.y = qToBigEndian<quint16>(qMax(event.y, 0));
+        queueMessage(&pe, sz_rfbPointerEventMsg);
+        m_sendBatchHasInput = true;
+        m_inputLatency.messages++;
+        break;
+    }
+    case ClientEvent::ClientCut: {
+        flushMessages();
+        QMutexLocker locker(&mutex);
+        QByteArray toLatin1Converted = m_cutText.toLatin1();
+        locker.unlock();
+        SendClientCutText(cl, toLatin1Converted.data(), toLatin1Converted.length());
+        break;
+    }
+    case ClientEvent::Reconfigure:
+        flushMessages();
+        SetFormatAndEncodings(cl);
+        break;
+    case ClientEvent::Viewport:
+        flushMessages();
+        m_viewport = QRect(event.x, event.y, event.width, event.height);
+        updateViewport();
+        break;
+    case ClientEvent::ScaleTarget:
+        m_scaleTarget = QSize(event.width, event.height);
+        updateServerScale();
+        break;
+    case ClientEvent::DesktopSize:
+#ifdef LIBVNCCLIENT_HAS_EXTDESKTOPSIZE
+        flushMessages();
+        // libvncclient only sends this once the server announced
+        // ExtendedDesktopSize, and if the size differs from the current one.
+        // The server then resizes the framebuffer, see newclient().
+        SendExtDesktopSize(cl, event.width, event.height);
+#endif
+        break;
+    }
+}
+
+void VncClientThread::queueMessage(const void *message, int size)
+{
+    if (m_sendBatchSize + size > int(m_sendBatch.size())) {
+        flushMessages();
+    }
+    memcpy(m_sendBatch.data() + m_sendBatchSize, message, size);
+    m_sendBatchSize += size;
+}
+
+bool VncClientThread::flushMessages()
+{
+    if (m_writeFailed) {
+        m_sendBatchSize = 0;
+        return false;
+    }
+    if (m_sendBatchSize == 0) {
+        return true;
+    }
+    const bool written = WriteToRFBServer(cl, m_sendBatch.data(), m_sendBatchSize);
+    if (m_sendBatchHasInput) {
+        m_inputLatency.writes++;
+    }
+    m_sendBatchSize = 0;
+    m_sendBatchHasInput = false;
+    if (!written) {
+        qCWarning(KRDC) << "Could not write to the VNC server";
+        m_writeFailed = true;
+        connectionLost(i18n("Disconnected: could not send to the VNC server."));
+        return false;
+    }
+    return true;
+}
+
+void VncClientThread::wakeup()
+{
+    if (m_wakeupPipe[1] < 0) {
+        return;
+    }
+    // The pipe is non-blocking: if it is full, the VNC thread has enough
+    // pending wakeups already.
+    const char c = 0;
+    while (write(m_wakeupPipe[1], &c, 1) < 0 && errno == EINTR) { }
+}
+
+void VncClientThread::drainWakeupPipe()
+{
+    char buffer[64];
+    while (read(m_wakeupPipe[0], buffer, sizeof(buffer)) > 0) { }
+}
+
+int VncClientThread::waitForMessage(int timeout)
+{
+    // libvncclient may already hold unprocessed data in its read buffer,
+    // in which case the socket itself will not become readable.
+    if (cl->buffered > 0) {
+        return 1;
+    }
+    // With a reader, wait for it rather than for the socket it drains.
+    const bool reader = m_socketReader.isReading();
+    if (reader && m_socketReader.canRead()) {
+        return 1;
+    }
+
+    pollfd fds[2];
+    fds[0].fd = reader ? m_socketReader.notifier() : cl->sock;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = m_wakeupPipe[0];
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+
+    const int ret = poll(fds, m_wakeupPipe[0] < 0 ? 1 : 2, timeout);
+    if (ret < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        qCritical(KRDC) << "poll()" << strerror(errno);
+        return -1;
+    }
+
+    if (fds[1].revents & POLLIN) {
+        drainWakeupPipe();
+    }
+
+    if (reader && (fds[0].revents & POLLIN)) {
+        m_socketReader.clearNotification();
+        return m_socketReader.canRead() ? 1 : 0;
+    }
+    return (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) ? 1 : 0;
+}
+
+void VncClientThread::pauseUpdates(bool paused)
+{
+    if (paused == m_paused) {
+        return;
+    }
+    m_paused = paused;
+
+    if (paused) {
+        m_pauseStart = m_clock.nsecsElapsed();
+        enableContinuousUpdates(false);
+        return;
+    }
+
+    const qint64 pausedNsecs = m_clock.nsecsElapsed() - m_pauseStart;
+    m_totalPausedNsecs += pausedNsecs;
+    qCDebug(KRDC) << "Updates resumed after" << pausedNsecs / 1000000 << "ms";
+
+    // Changes made meanwhile were never sent, ask for the whole area.
+    flushMessages();
+    SendFramebufferUpdateRequest(cl, cl->updateRect.x, cl->updateRect.y, cl->updateRect.w, cl->updateRect.h, FALSE);
+    m_updateRequestDue = false;
+    m_fullUpdateDue = false;
+    m_lastUpdateRequest = m_clock.nsecsElapsed();
+    enableContinuousUpdates(true);
+}
+
+void VncClientThread::holdUpdateRequests(bool hold)
+{
+    // libvncclient offers no way to turn off its automatic incremental
+    // requests, but skips any message the server does not support.
+    const int byte = rfbFramebufferUpdateRequest / 8;
+    const int bit = 1 << (rfbFramebufferUpdateRequest % 8);
+    if (hold) {
+        cl->supportedMessages.client2server[byte] &= ~bit;
+    } else {
+        cl->supportedMessages.client2server[byte] |= bit;
+    }
+    m_holdingUpdateRequests = hold;
+}
+
+int VncClientThread::sendPacedUpdateRequest()
+{
+    if (!m_updateRequestDue || m_paused) {
+        return -1;
+    }
+    if (m_continuousUpdates && !m_fullUpdateDue) {
+        // The server sends updates on its own.
+        m_updateRequestDue = false;
+        return -1;
+    }
+
+    const qint64 now = m_clock.nsecsElapsed();
+    const qint64 due = m_updateRate > 0 ? m_lastUpdateRequest + 1000000000LL / m_updateRate : now;
+    if (now < due && !m_fullUpdateDue && now - m_lastInput >= INTERACTIVE_NSECS) {
+        return int((due - now + 999999) / 1000000);
+    }
+
+    flushMessages();
+    SendFramebufferUpdateRequest(cl, cl->updateRect.x, cl->updateRect.y, cl->updateRect.w, cl->updateRect.h, m_fullUpdateDue ? FALSE : TRUE);
+    m_updateRequestDue = false;
+    m_fullUpdateDue = false;
+    m_lastUpdateRequest = now;
+    return -1;
 }
 
 void VncClientThread::run()
@@ -543,40 +1394,65 @@ void VncClientThread::run()
 
     locker.relock();
     qCDebug(KRDC) << "--------------------- Starting main VNC event loop ---------------------";
+    const qint64 loopStart = m_clock.nsecsElapsed();
     while (!m_stopped) {
         locker.unlock();
-        const int i = WaitForMessage(cl, 500);
+        pauseUpdates(m_updatesPaused);
+        // Queued input, pausing and stop() all wake us up, only a held back
+        // update request needs a timeout.
+        const int i = waitForMessage(sendPacedUpdateRequest());
         if (m_stopped || i < 0) {
             break;
         }
+        bool handled = true;
         if (i) {
-            if (!HandleRFBServerMessage(cl)) {
-                if (m_keepalive.failed) {
-                    do {
-                        // Reconnect after a short delay. That way, if the
-                        // attempt fails very quickly, we don't sit in a very
-                        // tight loop.
-                        clientDestroy();
-                        msleep(1000);
-                        clientStateChange(RemoteView::Connecting, i18n("Reconnecting."));
-                    } while (!clientCreate(true));
-                    continue;
-                }
+            m_messageStart = m_clock.nsecsElapsed();
+            m_messageStartCpu = threadCpuNsecs();
+            // With continuous updates, requests are useless, and while paused
+            // they are only sent on resume.
+            const bool pace = (m_updateRate > 0 || m_continuousUpdates || m_paused) && SupportsClient2Server(cl, rfbFramebufferUpdateRequest);
+            if (pace) {
+                holdUpdateRequests(true);
+            }
+            handled = HandleRFBServerMessage(cl);
+            if (pace) {
+                holdUpdateRequests(false);
+            }
+            if (!handled) {
                 qCritical(KRDC) << "HandleRFBServerMessage failed";
-                break;
             }
         }
 
-        locker.relock();
-        while (!m_eventQueue.isEmpty()) {
-            ClientEvent *clientEvent = m_eventQueue.dequeue();
-            locker.unlock();
-            clientEvent->fire(cl);
-            delete clientEvent;
-            locker.relock();
+        // Also fails if any write since the last iteration failed.
+        if (handled && !processEventQueue()) {
+            handled = false;
         }
+        if (!handled) {
+            if (m_keepalive.failed && !m_stopped) {
+                if (!reconnect()) {
+                    break;
+                }
+                locker.relock();
+                continue;
+            }
+            break;
+        }
+        locker.relock();
     }
 
+    const InputStatistics stats = inputStatistics();
+    qCDebug(KRDC) << "Input events:" << stats.events << "average queue-to-wire latency (us):" << (stats.events ? stats.totalLatencyUsecs / stats.events : 0)
+                  << "max:" << stats.maxLatencyUsecs << "coalesced:" << stats.coalescedPointerEvents << "dropped:" << stats.droppedEvents
+                  << "messages:" << stats.messages << "writes:" << stats.writes;
+    if (m_paused) {
+        m_totalPausedNsecs += m_clock.nsecsElapsed() - m_pauseStart;
+    }
+    // While paused, at most the update requested before was received.
+    qCDebug(KRDC) << "Updates paused for" << m_totalPausedNsecs / 1000000 << "ms in total";
+    const qint64 receivingNsecs = m_clock.nsecsElapsed() - loopStart - m_totalPausedNsecs;
+    qCDebug(KRDC) << "Framebuffer updates:" << m_framebufferUpdates << "per second:" << (receivingNsecs > 0 ? m_framebufferUpdates * 1e9 / receivingNsecs : 0)
+                  << "with continuous updates:" << m_continuousFramebufferUpdates << "fences answered:" << m_fencesAnswered;
+
     m_stopped = true;
 }
 
@@ -593,6 +1469,18 @@ bool VncClientThread::clientCreate(bool reinitialising)
     rfbClientLog = outputHandlerStatic;
     rfbClientErr = outputHandlerStatic;
 
+    // libvncclient keeps a single list of extensions for all clients, add
+    // ours once. Its handlers find their thread through the client data.
+    static const bool extensionRegistered = []() {
+        static int encodings[] = {ENCODING_FENCE, ENCODING_CONTINUOUS_UPDATES, 0};
+        static rfbClientProtocolExtension extension = {};
+        extension.encodings = encodings;
+        extension.handleMessage = handleMessageStatic;
+        rfbClientRegisterExtension(&extension);
+        return true;
+    }();
+    Q_UNUSED(extensionRegistered);
+
     // 24bit color dept in 32 bits per pixel = default. Will change colordepth and bpp later if needed
     cl = rfbGetClient(8, 3, 4);
     setClientColorDepth(cl, this->colorDepth());
@@ -602,6 +1490,8 @@ bool VncClientThread::clientCreate(bool reinitialising)
     cl->GetCredential = credentialHandlerStatic;
     cl->GotFrameBufferUpdate = updatefbStaticPartial;
     cl->FinishedFrameBufferUpdate = updateFbStaticFinished;
+    m_defaultCopyRect = cl->GotCopyRect;
+    cl->GotCopyRect = copyRectStatic;
     cl->GotXCutText = cuttextStatic;
     cl->GotCursorShape = cursorShapeHandlerStatic;
     rfbClientSetClientData(cl, nullptr, this);
@@ -612,15 +1502,33 @@ bool VncClientThread::clientCreate(bool reinitialising)
 
     cl->serverPort = m_port;
 
+    m_encodingController.reset(quality());
+    m_updatePixels = 0;
+    m_updateRequestDue = false;
+    m_fullUpdateDue = false;
+    m_dirtyRegion = QRegion();
+    m_updateCopies.clear();
+    m_copyDestination = QRect();
+    // The scale is per connection.
+    m_serverScale = 1;
+    m_unscaledSize = QSize();
+    m_serverFences = false;
+    m_serverContinuousUpdates = false;
+    m_continuousUpdates = false;
+    m_pendingContinuousUpdatesEnds = 0;
+    m_sendBatchSize = 0;
+    m_sendBatchHasInput = false;
+    m_writeFailed = false;
+
     qCDebug(KRDC) << "--------------------- trying init ---------------------";
 
-    if (!rfbInitClient(cl, nullptr, nullptr)) {
+    if (!clientConnect()) {
         if (!reinitialising) {
             // Don't whine on reconnection failure: presumably the network
             // is simply still down.
-            qCCritical(KRDC) << "rfbInitClient failed";
+            qCCritical(KRDC) << "Connecting to the VNC server failed";
         }
-        cl = nullptr;
+        clientDestroy();
         return false;
     }
 
@@ -630,14 +1538,224 @@ bool VncClientThread::clientCreate(bool reinitialising)
         clientStateChange(RemoteView::Connected, i18n("Connected."));
     }
     clientSetKeepalive();
+    clientSetNoDelay();
+    clientStartReader();
     return true;
 }
 
+bool VncClientThread::clientConnect()
+{
+    const int sock = connectToServer();
+    if (sock < 0) {
+        if (!m_stopped) {
+            rfbClientErr("Unable to connect to VNC server\n");
+        }
+        return false;
+    }
+    // From now on rfbClientCleanup() closes it.
+    cl->sock = sock;
+
+    QMutexLocker locker(&mutex);
+    if (m_stopped) {
+        return false;
+    }
+    m_socket = sock;
+    locker.unlock();
+
+    if (!InitialiseRFBConnection(cl)) {
+        return false;
+    }
+
+    cl->width = cl->si.framebufferWidth;
+    cl->height = cl->si.framebufferHeight;
+    if (!cl->MallocFrameBuffer(cl)) {
+        return false;
+    }
+
+    if (!SetFormatAndEncodings(cl)) {
+        return false;
+    }
+
+    if (cl->updateRect.x < 0) {
+        cl->updateRect.x = cl->updateRect.y = 0;
+        cl->updateRect.w = cl->width;
+        cl->updateRect.h = cl->height;
+    }
+
+    if (cl->appData.scaleSetting > 1) {
+        const int scale = cl->appData.scaleSetting;
+        if (!SendScaleSetting(cl, scale)) {
+            return false;
+        }
+        return SendFramebufferUpdateRequest(cl, cl->updateRect.x / scale, cl->updateRect.y / scale, cl->updateRect.w / scale, cl->updateRect.h / scale, FALSE);
+    }
+    return SendFramebufferUpdateRequest(cl, cl->updateRect.x, cl->updateRect.y, cl->updateRect.w, cl->updateRect.h, FALSE);
+}
+
+int VncClientThread::connectToServer()
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+
+    addrinfo *result = nullptr;
+    const QByteArray port = QByteArray::number(cl->serverPort);
+    const int error = getaddrinfo(cl->serverHost, port.constData(), &hints, &result);
+    if (error != 0) {
+        rfbClientErr("Couldn't convert '%s' to host address: %s\n", cl->serverHost, gai_strerror(error));
+        return -1;
+    }
+
+    // Alternate between the address families, starting with the one the
+    // resolver prefers, so that a broken family costs a single attempt delay.
+    std::vector<const addrinfo *> preferred;
+    std::vector<const addrinfo *> others;
+    for (const addrinfo *address = result; address; address = address->ai_next) {
+        if (address->ai_family == AF_INET || address->ai_family == AF_INET6) {
+            (address->ai_family == result->ai_family ? preferred : others).push_back(address);
+        }
+    }
+    std::vector<const addrinfo *> addresses;
+    for (size_t i = 0; i < qMax(preferred.size(), others.size()); ++i) {
+        if (i < preferred.size()) {
+            addresses.push_back(preferred[i]);
+        }
+        if (i < others.size()) {
+            addresses.push_back(others[i]);
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<pollfd> pending; // connect() in progress
+    size_t next = 0;
+    qint64 nextAttempt = 0;
+    int connected = -1;
+
+    while (connected < 0 && !m_stopped && timer.elapsed() < CONNECT_TIMEOUT_MS) {
+        // Start another attempt when its time has come, or right away if all
+        // previous ones failed already.
+        if (next < addresses.size() && (timer.elapsed() >= nextAttempt || pending.empty())) {
+            const addrinfo *address = addresses[next++];
+            nextAttempt = timer.elapsed() + CONNECTION_ATTEMPT_DELAY_MS;
+            const int fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+                connected = fd;
+            } else if (errno == EINPROGRESS) {
+                pending.push_back({fd, POLLOUT, 0});
+            } else {
+                close(fd);
+            }
+            continue;
+        }
+        if (pending.empty()) {
+            break; // every address failed
+        }
+
+        qint64 timeout = CONNECT_TIMEOUT_MS - timer.elapsed();
+        if (next < addresses.size()) {
+            timeout = qMin(timeout, nextAttempt - timer.elapsed());
+        }
+
+        std::vector<pollfd> fds = pending;
+        fds.push_back({m_wakeupPipe[0], POLLIN, 0});
+        if (poll(fds.data(), fds.size(), int(qMax<qint64>(timeout, 0))) < 0 && errno != EINTR) {
+            qCritical(KRDC) << "poll()" << strerror(errno);
+            break;
+        }
+        if (fds.back().revents & POLLIN) {
+            drainWakeupPipe();
+        }
+
+        std::vector<pollfd> stillPending;
+        for (size_t i = 0; i < pending.size(); ++i) {
+            if (!fds[i].revents) {
+                stillPending.push_back(pending[i]);
+                continue;
+            }
+            int socketError = 0;
+            socklen_t length = sizeof(socketError);
+            if (connected < 0 && getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &socketError, &length) == 0 && socketError == 0) {
+                connected = fds[i].fd;
+            } else {
+                close(fds[i].fd);
+            }
+        }
+        pending.swap(stillPending);
+    }
+
+    for (const pollfd &attempt : pending) {
+        close(attempt.fd);
+    }
+    freeaddrinfo(result);
+
+    if (connected >= 0 && m_stopped) {
+        close(connected);
+        return -1;
+    }
+    // Like ConnectToRFBServer(), hand libvncclient a blocking socket: its
+    // TLS handshakes and WriteToRFBServer() poll a non-blocking one.
+    if (connected >= 0) {
+        fcntl(connected, F_SETFL, fcntl(connected, F_GETFL) & ~O_NONBLOCK);
+    }
+    return connected;
+}
+
+bool VncClientThread::reconnect()
+{
+    int delay = RECONNECT_MIN_DELAY_MS;
+    for (;;) {
+        clientDestroy();
+        clientStateChange(RemoteView::Connecting, i18n("Reconnecting."));
+
+        // Retry quickly at first, then less and less often while the server
+        // stays unreachable. The jitter keeps the clients of a restarting
+        // server from all coming back at the same time.
+        const int jitteredDelay = delay / 2 + QRandomGenerator::global()->bounded(delay / 2 + 1);
+        if (!sleepUnlessStopped(jitteredDelay)) {
+            return false;
+        }
+        if (clientCreate(true)) {
+            return true;
+        }
+        if (m_stopped) {
+            return false;
+        }
+        delay = qMin(delay * 2, RECONNECT_MAX_DELAY_MS);
+    }
+}
+
+bool VncClientThread::sleepUnlessStopped(int msecs)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!m_stopped) {
+        const qint64 remaining = msecs - timer.elapsed();
+        if (remaining <= 0) {
+            return true;
+        }
+        // Only wakeup() interrupts this, e.g. from stop().
+        waitForMessage(int(remaining), false);
+    }
+    return false;
+}
+
 /**
  * Undo @see clientCreate().
  */
 void VncClientThread::clientDestroy()
 {
+    // Before libvncclient closes the socket.
+    m_socketReader.stopReading();
+
+    QMutexLocker locker(&mutex);
+    m_socket = -1;
+    locker.unlock();
+
     if (cl) {
         // Disconnect from vnc server & cleanup allocated resources
         rfbClientCleanup(cl);
@@ -645,6 +1763,30 @@ void VncClientThread::clientDestroy()
     }
 }
 
+/**
+ * libvncclient reads the socket only when it handles a server message, so
+ * while an update is being decoded nothing is read and the TCP receive window
+ * fills up, which stalls the server. A reader thread keeps draining it.
+ */
+void VncClientThread::clientStartReader()
+{
+#ifdef LIBVNCCLIENT_HAS_READ_HOOK
+    // TLS and SASL do their own reads on the socket.
+    if (cl->tlsSession) {
+        return;
+    }
+#ifdef LIBVNCSERVER_HAVE_SASL
+    if (cl->saslconn) {
+        return;
+    }
+#endif
+    // Whatever libvncclient buffered during the handshake is read first.
+    if (m_socketReader.startReading(cl->sock)) {
+        cl->ReadFromSocket = readFromSocketStatic;
+    }
+#endif
+}
+
 /**
  * The VNC client library does not make use of keepalives. We go behind its
  * back to set it up.
@@ -688,6 +1830,19 @@ void VncClientThread::clientSetKeepalive()
     qCDebug(KRDC) << "TCP keepalive set";
 }
 
+/**
+ * Input is batched by flushMessages(), so every write we issue is a
+ * complete burst and should go out immediately rather than wait for
+ * Nagle's algorithm to collect more data.
+ */
+void VncClientThread::clientSetNoDelay()
+{
+    int optval = 1;
+    if (setsockopt(cl->sock, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) < 0) {
+        qCritical(KRDC) << "setsockopt(TCP_NODELAY)" << strerror(errno);
+    }
+}
+
 /**
  * The VNC client state changed.
  */
@@ -697,56 +1852,81 @@ void VncClientThread::clientStateChange(RemoteView::RemoteStatus status, const Q
     Q_EMIT clientStateChanged(status, details);
 }
 
-ClientEvent::~ClientEvent()
+void VncClientThread::mouseEvent(int x, int y, int buttonMask)
 {
-}
+    if (m_stopped)
+        return;
 
-void ReconfigureEvent::fire(rfbClient *cl)
-{
-    SetFormatAndEncodings(cl);
+    ClientEvent event;
+    event.type = ClientEvent::Pointer;
+    event.x = x;
+    event.y = y;
+    event.buttonMask = buttonMask;
+    enqueueEvent(event);
 }
 
-void PointerClientEvent::fire(rfbClient *cl)
+void VncClientThread::keyEvent(int key, bool pressed)
 {
-    SendPointerEvent(cl, m_x, m_y, m_buttonMask);
-}
+    if (m_stopped)
+        return;
 
-void KeyClientEvent::fire(rfbClient *cl)
-{
-    SendKeyEvent(cl, m_key, m_pressed);
+    ClientEvent event;
+    event.type = ClientEvent::Key;
+    event.key = key;
+    event.pressed = pressed;
+    enqueueEvent(event);
 }
 
-void ClientCutEvent::fire(rfbClient *cl)
+void VncClientThread::clientCut(const QString &text)
 {
-    QByteArray toLatin1Converted = text.toLatin1();
-    SendClientCutText(cl, toLatin1Converted.data(), toLatin1Converted.length());
+    QMutexLocker lock(&mutex);
+    if (m_stopped)
+        return;
+
+    m_cutText = text;
+    lock.unlock();
+
+    ClientEvent event;
+    event.type = ClientEvent::ClientCut;
+    enqueueEvent(event);
 }
 
-void VncClientThread::mouseEvent(int x, int y, int buttonMask)
+void VncClientThread::setViewport(const QRect &viewport)
 {
-    QMutexLocker lock(&mutex);
     if (m_stopped)
         return;
 
-    m_eventQueue.enqueue(new PointerClientEvent(x, y, buttonMask));
+    ClientEvent event;
+    event.type = ClientEvent::Viewport;
+    event.x = viewport.x();
+    event.y = viewport.y();
+    event.width = viewport.width();
+    event.height = viewport.height();
+    enqueueEvent(event);
 }
 
-void VncClientThread::keyEvent(int key, bool pressed)
+void VncClientThread::setScaleTarget(const QSize &size)
 {
-    QMutexLocker lock(&mutex);
     if (m_stopped)
         return;
 
-    m_eventQueue.enqueue(new KeyClientEvent(key, pressed));
+    ClientEvent event;
+    event.type = ClientEvent::ScaleTarget;
+    event.width = size.width();
+    event.height = size.height();
+    enqueueEvent(event);
 }
 
-void VncClientThread::clientCut(const QString &text)
+void VncClientThread::requestDesktopSize(const QSize &size)
 {
-    QMutexLocker lock(&mutex);
-    if (m_stopped)
+    if (m_stopped || size.isEmpty())
         return;
 
-    m_eventQueue.enqueue(new ClientCutEvent(text));
+    ClientEvent event;
+    event.type = ClientEvent::DesktopSize;
+    event.width = qMin(size.width(), 0xffff);
+    event.height = qMin(size.height(), 0xffff);
+    enqueueEvent(event);
 }
 
 #include "moc_vncclientthread.cpp"
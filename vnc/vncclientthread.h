@@ -14,76 +14,109 @@
 #endif
 
 #include "remoteview.h"
+#include "vncencodingcontroller.h"
+#include "vncsocketreader.h"
 
+#include <QCache>
+#include <QCursor>
+#include <QElapsedTimer>
 #include <QImage>
 #include <QMutex>
-#include <QQueue>
+#include <QRegion>
 #include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include <array>
+#include <atomic>
 
 extern "C" {
 #include <rfb/rfbclient.h>
 }
 
-class ClientEvent
-{
-public:
-    virtual ~ClientEvent();
+/**
+ * A client to server message, as queued by the GUI thread for the VNC
+ * thread. Plain data so that queuing an event never allocates.
+ */
+struct ClientEvent {
+    enum Type {
+        Key,
+        Pointer,
+        ClientCut,
+        Reconfigure,
+        // Area of the framebuffer visible to the user.
+        Viewport,
+        // Size the framebuffer is scaled to for display.
+        ScaleTarget,
+        // Ask the server to resize its desktop.
+        DesktopSize,
+    };
 
-    virtual void fire(rfbClient *) = 0;
+    Type type = Reconfigure;
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    int buttonMask = 0;
+    int key = 0;
+    bool pressed = false;
+    // Time (see VncClientThread::m_clock) at which the event was queued.
+    qint64 queuedAt = 0;
 };
 
-class ReconfigureEvent : public ClientEvent
+/**
+ * Fixed size single-producer/single-consumer ring of client events. The
+ * GUI thread pushes, the VNC thread peeks and pops; neither side locks or
+ * allocates.
+ */
+class ClientEventRing
 {
 public:
-    void fire(rfbClient *) override;
-};
+    static constexpr quint32 Capacity = 1024; // must be a power of two
 
-class KeyClientEvent : public ClientEvent
-{
-public:
-    KeyClientEvent(int key, int pressed)
-        : m_key(key)
-        , m_pressed(pressed)
+    // Producer side. Returns false if the ring is full.
+    bool push(const ClientEvent &event)
     {
+        const quint32 head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        m_events[head & (Capacity - 1)] = event;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
     }
 
-    void fire(rfbClient *) override;
-
-private:
-    int m_key;
-    int m_pressed;
-};
-
-class PointerClientEvent : public ClientEvent
-{
-public:
-    PointerClientEvent(int x, int y, int buttonMask)
-        : m_x(x)
-        , m_y(y)
-        , m_buttonMask(buttonMask)
+    // Consumer side. Returns the index-th oldest event or nullptr if the
+    // ring does not hold that many events.
+    const ClientEvent *peek(quint32 index = 0) const
     {
+        const quint32 tail = m_tail.load(std::memory_order_relaxed);
+        if (m_head.load(std::memory_order_acquire) - tail <= index) {
+            return nullptr;
+        }
+        return &m_events[(tail + index) & (Capacity - 1)];
     }
 
-    void fire(rfbClient *) override;
-
-private:
-    int m_x;
-    int m_y;
-    int m_buttonMask;
-};
-
-class ClientCutEvent : public ClientEvent
-{
-public:
-    explicit ClientCutEvent(const QString &text)
-        : text(text)
+    // Consumer side. Drops the event returned by peek().
+    void pop()
     {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
     }
 
-    void fire(rfbClient *) override;
-
 private:
-    QString text;
+    std::array<ClientEvent, Capacity> m_events;
+    alignas(64) std::atomic<quint32> m_head{0};
+    alignas(64) std::atomic<quint32> m_tail{0};
+};
+
+/**
+ * A CopyRect from the server: the framebuffer content at source moved by
+ * (dx, dy).
+ */
+struct FramebufferCopy {
+    QRect source;
+    int dx = 0;
+    int dy = 0;
 };
 
 class VncClientThread : public QThread
@@ -98,11 +131,37 @@ public:
     };
     Q_ENUM(ColorDepth)
 
+    /**
+     * Counters describing how long input events waited between being
+     * queued by the GUI thread and being written to the server.
+     */
+    struct InputStatistics {
+        quint64 events = 0;
+        quint64 totalLatencyUsecs = 0;
+        quint64 maxLatencyUsecs = 0;
+        // Events dropped because the queue to the VNC thread was full.
+        quint64 droppedEvents = 0;
+        // Pointer motion events merged into a later one.
+        quint64 coalescedPointerEvents = 0;
+        // Key and pointer messages and the socket writes used to send them,
+        // their ratio is the batching factor.
+        quint64 messages = 0;
+        quint64 writes = 0;
+    };
+
     explicit VncClientThread(QObject *parent = nullptr);
     ~VncClientThread() override;
-    const QImage image(int x = 0, int y = 0, int w = 0, int h = 0);
-    void setImage(const QImage &img);
-    void emitUpdated(int x, int y, int w, int h);
+    /**
+     * Bring @p frame up to date with the latest published framebuffer and
+     * return the region that changed since the last call. Called by the
+     * GUI thread after imageUpdated().
+     *
+     * If @p copies is given, areas the server merely copied are not part of
+     * the returned region but listed there, in order, to be applied to what
+     * is on screen before repainting the region.
+     */
+    QRegion takeFrame(QImage &frame, QVector<FramebufferCopy> *copies = nullptr);
+    void emitUpdated();
     void emitGotCut(const QString &text);
     void stop();
     void setHost(const QString &host);
@@ -114,6 +173,26 @@ public:
         m_password = password;
     }
     void setShowLocalCursor(bool show);
+    void setCoalescePointerMotion(bool coalesce);
+    void setAdaptiveEncoding(bool adaptive);
+    /**
+     * Let servers supporting it (UltraVNC SetScale or PalmVNC) scale the
+     * framebuffer down when it is displayed much smaller than it is.
+     */
+    void setServerScaling(bool serverScaling);
+    /**
+     * Request updates at most @p fps times per second, or as fast as the
+     * server sends them if 0. Input lifts the limit for a moment. Servers
+     * with continuous updates pace the updates themselves, by what the link
+     * takes, and are not limited.
+     */
+    void setUpdateRate(int fps);
+    /**
+     * Stop requesting framebuffer updates while the view can not be seen,
+     * and ask for the whole viewport again on resume. Input is still sent
+     * and other server messages still handled.
+     */
+    void setUpdatesPaused(bool paused);
     const QString password() const
     {
         return m_password;
@@ -129,14 +208,23 @@ public:
 
     RemoteView::Quality quality() const;
     ColorDepth colorDepth() const;
+    InputStatistics inputStatistics() const;
     uint8_t *frameBuffer;
 
 Q_SIGNALS:
-    void imageUpdated(int x, int y, int w, int h);
+    /**
+     * A new frame was published, fetch it with takeFrame(). Not emitted
+     * again until the frame has been taken.
+     */
+    void imageUpdated();
     void gotCut(const QString &text);
     void gotCursor(const QCursor &cursor);
     void passwordRequest(bool includingUsername = false);
     void outputErrorMessage(const QString &message);
+    /**
+     * Informational message about the session, for the status bar.
+     */
+    void statusMessage(const QString &message);
 
     /**
      * When we connect/disconnect/reconnect/etc., this signal will be emitted.
@@ -147,9 +235,19 @@ Q_SIGNALS:
     void clientStateChanged(RemoteView::RemoteStatus status, const QString &details);
 
 public Q_SLOTS:
+    // Input is queued lock-free; these must only be called from one
+    // thread (the GUI thread).
     void mouseEvent(int x, int y, int buttonMask);
     void keyEvent(int key, bool pressed);
     void clientCut(const QString &text);
+    // Only keep the part of the framebuffer around viewport up to date.
+    void setViewport(const QRect &viewport);
+    // Size in device pixels the framebuffer is displayed at, invalid if it is
+    // not scaled.
+    void setScaleTarget(const QSize &size);
+    // Ask the server to resize the remote desktop to size, in device
+    // pixels. Does nothing if libvncclient or the server can not do it.
+    void requestDesktopSize(const QSize &size);
 
 protected:
     void run() override;
@@ -157,29 +255,97 @@ protected:
 private:
     void setClientColorDepth(rfbClient *cl, ColorDepth cd);
     void setColorDepth(ColorDepth colorDepth);
+    // Request the encodings of the current encoding controller profile.
+    void applyEncodingProfile();
+    // Restrict incremental update requests to m_viewport plus a margin and
+    // request the areas this newly covers in full.
+    void updateViewport();
+    // Ask the server for the scale matching m_scaleTarget, if it supports
+    // scaling and that changed.
+    void updateServerScale();
+
+    // Queue an event for the VNC thread and wake it up.
+    void enqueueEvent(ClientEvent event);
+    // Send all queued events to the server. Returns false if writing to the
+    // server failed.
+    bool processEventQueue();
+    void fireEvent(const ClientEvent &event);
+    // Append a message to the send batch, flushing it first if it is full.
+    void queueMessage(const void *message, int size);
+    // Write the send batch to the server in one go. Returns false, and
+    // treats the connection as lost, if the write failed.
+    bool flushMessages();
+    // Reconnect later if keepalive allows it, otherwise report @p details.
+    void connectionLost(const QString &details);
+
+    // Wake the VNC thread out of waitForMessage().
+    void wakeup();
+    void drainWakeupPipe();
+    // Wait until the server sent something, wakeup() was called or the
+    // timeout (in milliseconds, -1 for none) expired. Returns a positive
+    // value if a server message is pending, 0 if not and -1 on error.
+    int waitForMessage(int timeout);
+    // Apply m_updatesPaused, called by the VNC thread.
+    void pauseUpdates(bool paused);
+    // Hide FramebufferUpdateRequest from libvncclient, so that it does not
+    // request the next update on its own, or show it again.
+    void holdUpdateRequests(bool hold);
+    // Send the update request held back at the end of the last update once
+    // it is due. Returns the time in milliseconds until then, or -1 if
+    // nothing is waiting.
+    int sendPacedUpdateRequest();
 
     // These static methods are callback functions for libvncclient. Each
     // of them calls back into the corresponding member function via some
     // TLS-based logic.
     static rfbBool newclientStatic(rfbClient *cl);
     static void updatefbStaticPartial(rfbClient *cl, int x, int y, int w, int h);
+    static void copyRectStatic(rfbClient *cl, int srcX, int srcY, int w, int h, int destX, int destY);
     static void updateFbStaticFinished(rfbClient *cl);
     static void cuttextStatic(rfbClient *cl, const char *text, int textlen);
     static char *passwdHandlerStatic(rfbClient *cl);
     static rfbCredential *credentialHandlerStatic(rfbClient *cl, int credentialType);
     static void outputHandlerStatic(const char *format, ...);
     static void cursorShapeHandlerStatic(rfbClient *cl, int xhot, int yhot, int width, int height, int bpp);
+    static int readFromSocketStatic(rfbClient *cl, char *buffer, unsigned int size);
+    static rfbBool handleMessageStatic(rfbClient *cl, rfbServerToClientMsg *message);
 
     // Member functions corresponding to the above static methods.
     rfbBool newclient();
     void updatefbPartial(int x, int y, int w, int h);
+    void copyRect(int srcX, int srcY, int w, int h, int destX, int destY);
     void updatefbFinished();
     void cuttext(const char *text, int textlen);
     char *passwdHandler();
     rfbCredential *credentialHandler(int credentialType);
     void outputHandler(const char *format, va_list args);
 
+    // Server messages libvncclient does not know about, from the TigerVNC
+    // Fence and Continuous Updates extensions.
+    rfbBool handleFence();
+    rfbBool handleEndOfContinuousUpdates();
+    // Turn continuous updates on for cl->updateRect, or off, if the server
+    // supports them.
+    void enableContinuousUpdates(bool enable);
+
+    // Convert the damaged and copied parts of the decoded framebuffer into
+    // m_image.
+    void publishFrame(const QImage &frameBuffer, const QRegion &damage, const QVector<FramebufferCopy> &copies);
+
+    // Latest published frame, written by the VNC thread and read by the GUI
+    // thread in takeFrame(), both under mutex. The VNC thread keeps decoding
+    // into frameBuffer meanwhile. Always Format_RGB32, whatever the colour
+    // depth of the connection.
     QImage m_image;
+    // Damage published but not yet taken by the GUI thread...
+    QRegion m_pendingDamage;
+    // ...and copies, with the region they wrote to.
+    QVector<FramebufferCopy> m_pendingCopies;
+    QRegion m_pendingCopiedRegion;
+    // Splits large conversions in publishFrame(). Decoding stays on the VNC
+    // thread, inside libvncclient.
+    QThreadPool m_conversionPool;
+    bool m_updatePending;
     rfbClient *cl;
     QString m_host;
     QString m_password;
@@ -190,12 +356,114 @@ private:
     RemoteView::Quality m_quality;
     qreal m_devicePixelRatio;
     ColorDepth m_colorDepth;
-    QQueue<ClientEvent *> m_eventQueue;
+    ClientEventRing m_eventRing;
+    // Text of the latest ClientCut event, protected by mutex.
+    QString m_cutText;
+    // Self-pipe used to interrupt waitForMessage() when input is queued.
+    int m_wakeupPipe[2];
+    // Socket of the current connection, shut down by stop() to interrupt
+    // the handshake or a blocking read. Protected by mutex.
+    int m_socket;
+    QElapsedTimer m_clock;
+    struct {
+        std::atomic<quint64> events{0};
+        std::atomic<quint64> totalUsecs{0};
+        std::atomic<quint64> maxUsecs{0};
+        std::atomic<quint64> dropped{0};
+        std::atomic<quint64> coalesced{0};
+        std::atomic<quint64> messages{0};
+        std::atomic<quint64> writes{0};
+    } m_inputLatency;
+    // Merge queued pointer motion with identical button masks.
+    bool m_coalescePointerMotion;
+    // Button mask of the last pointer event sent, only used by the VNC thread.
+    int m_lastButtonMask;
+    // Key and pointer messages drained in one loop iteration, written with
+    // a single write by flushMessages().
+    std::array<char, 4096> m_sendBatch;
+    int m_sendBatchSize;
+    // Whether m_sendBatch holds input, only such writes are counted.
+    bool m_sendBatchHasInput;
+    // Set by a failed flushMessages() until the next connection.
+    bool m_writeFailed;
     // color table for 8bit indexed colors
     QVector<QRgb> m_colorTable;
+    // Cursors already converted from a shape sent by the server, keyed by the
+    // raw shape (see cursorShapeKey()). Servers tend to cycle through a few
+    // shapes, only used by the VNC thread.
+    QCache<QByteArray, QCursor> m_cursorCache;
     QString outputErrorMessageString;
 
-    QRect m_dirtyRect;
+    // Damage collected from the rectangles of the current framebuffer update.
+    QRegion m_dirtyRegion;
+    // CopyRects of the current update, and the destination of the last one,
+    // which libvncclient reports to updatefbPartial() right after.
+    QVector<FramebufferCopy> m_updateCopies;
+    QRect m_copyDestination;
+    // libvncclient's CopyRect handler, which moves the pixels in frameBuffer.
+    GotCopyRectProc m_defaultCopyRect;
+    // Geometry of frameBuffer, which survives reconnections.
+    QSize m_frameBufferSize;
+    int m_frameBufferDepth;
+
+    // Last viewport set by the GUI, invalid for the whole framebuffer. Only
+    // used by the VNC thread.
+    QRect m_viewport;
+
+    // Server side scaling: the server divides its framebuffer size by
+    // m_serverScale, m_unscaledSize is the size before that. All but
+    // m_serverScaling are only used by the VNC thread.
+    bool m_serverScaling;
+    QSize m_scaleTarget;
+    QSize m_unscaledSize;
+    int m_serverScale;
+
+    // Requested by the GUI thread...
+    std::atomic<bool> m_updatesPaused;
+    // ...and applied by the VNC thread, which then holds back update
+    // requests. The server stops sending updates as soon as it has answered
+    // the pending one, other messages such as fences are still handled.
+    bool m_paused;
+    qint64 m_pauseStart;
+    qint64 m_totalPausedNsecs;
+
+    // Framebuffer updates received, in total and while continuous updates
+    // were on, and fences answered. Logged when the thread ends, for
+    // comparing update rates with and without continuous updates.
+    quint64 m_framebufferUpdates;
+    quint64 m_continuousFramebufferUpdates;
+    quint64 m_fencesAnswered;
+
+    // Update request pacing, see setUpdateRate(). While a server message
+    // is handled with m_holdingUpdateRequests, libvncclient can not request
+    // the next update: the end of an update sets m_updateRequestDue instead,
+    // and a framebuffer resize m_fullUpdateDue. Time of the last paced
+    // request and of the last key or pointer event sent.
+    int m_updateRate;
+    bool m_holdingUpdateRequests;
+    bool m_updateRequestDue;
+    bool m_fullUpdateDue;
+    qint64 m_lastUpdateRequest;
+    qint64 m_lastInput;
+
+    // The server answered the Fence and Continuous Updates pseudo-encodings.
+    // With continuous updates on, it sends updates for cl->updateRect
+    // without waiting for requests, and relies on our answers to its fences
+    // to measure the link and limit the data in flight.
+    bool m_serverFences;
+    bool m_serverContinuousUpdates;
+    bool m_continuousUpdates;
+    // Disables sent, each answered by an EndOfContinuousUpdates not read yet.
+    int m_pendingContinuousUpdatesEnds;
+
+    // Adapt the encodings to the measured cost of updates.
+    bool m_adaptiveEncoding;
+    VncEncodingController m_encodingController;
+    // Wall clock (see m_clock) and thread CPU time at which the server
+    // message being handled started, and pixels in the current update.
+    qint64 m_messageStart;
+    qint64 m_messageStartCpu;
+    qint64 m_updatePixels;
 
     volatile bool m_stopped;
     volatile bool m_passwordError;
@@ -226,12 +494,34 @@ private:
     // Initialise the VNC client library object.
     bool clientCreate(bool reinitialising);
 
+    // Connect to the server and go through what rfbInitClient() does once
+    // connected, with a connection we can time out and cancel.
+    bool clientConnect();
+
+    // Open a TCP connection to the server, racing its IPv6 and IPv4
+    // addresses. Returns the socket or -1 on failure, timeout or stop().
+    int connectToServer();
+
+    // After a keepalive failure, reconnect with exponential backoff.
+    // Returns false if stopped meanwhile.
+    bool reconnect();
+
+    // Sleep, unless stop() is called. Returns false if stopped.
+    bool sleepUnlessStopped(int msecs);
+
     // Uninitialise the VNC client library object.
     void clientDestroy();
 
     // Turn on keepalive support.
     void clientSetKeepalive();
 
+    // Disable Nagle's algorithm, we batch writes ourselves.
+    void clientSetNoDelay();
+
+    // Read the socket on m_socketReader's thread from now on, if possible.
+    void clientStartReader();
+    VncSocketReader m_socketReader;
+
     // Record a state change.
     void clientStateChange(RemoteView::RemoteStatus status, const QString &details);
     QString m_previousDetails;
@@ -0,0 +1,171 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "vncencodingcontroller.h"
+#include "krdc_debug.h"
+
+#include <iterator>
+
+// From the most bandwidth hungry to the most compact. The lossless, balanced
+// and minimal profiles are what the High, Medium and Low qualities have always
+// requested.
+static const VncEncodingController::Profile PROFILES[] = {
+    {"lossless", "copyrect zlib hextile raw", 0, 9, false},
+    {"balanced", "copyrect tight zrle ultra zlib hextile corre rre raw", 5, 7, true},
+    {"compact", "copyrect tight zrle ultra zlib hextile corre rre raw", 9, 3, true},
+    {"minimal", "copyrect zrle ultra zlib hextile corre rre raw", 9, 1, false},
+};
+static const int PROFILE_COUNT = int(std::size(PROFILES));
+
+static const qint64 MSEC = 1000 * 1000;
+// A window is judged once it spans this long and holds enough updates.
+static const qint64 WINDOW_NSECS = 2000 * MSEC;
+static const int WINDOW_MIN_UPDATES = 5;
+// This many consecutive windows must agree before switching...
+static const int VOTES_TO_SWITCH = 3;
+// ...and a profile is kept at least this long.
+static const qint64 MIN_DWELL_NSECS = 10000 * MSEC;
+
+// Average time per update spent waiting for data, and shortest update round
+// trip, above which the link is considered congested...
+static const qint64 CONGESTED_WIRE_NSECS = 100 * MSEC;
+static const qint64 CONGESTED_ROUND_TRIP_NSECS = 200 * MSEC;
+// ...and below which it has room for a richer profile, provided decoding is
+// cheap enough as well.
+static const qint64 IDLE_WIRE_NSECS = 20 * MSEC;
+static const qint64 IDLE_ROUND_TRIP_NSECS = 30 * MSEC;
+static const qint64 IDLE_CPU_NSECS = 25 * MSEC;
+// A few small updates, like a blinking caret, tell nothing about the cost of
+// a richer profile. It takes this many pixels in a window to vote for one.
+static const qint64 RICHER_MIN_PIXELS = 1920 * 1080;
+
+VncEncodingController::VncEncodingController()
+{
+    reset(RemoteView::Unknown);
+}
+
+void VncEncodingController::reset(RemoteView::Quality quality)
+{
+    switch (quality) {
+    case RemoteView::High:
+        m_profile = 0;
+        break;
+    case RemoteView::Medium:
+        m_profile = 1;
+        break;
+    case RemoteView::Low:
+    case RemoteView::Unknown:
+    default:
+        m_profile = PROFILE_COUNT - 1;
+    }
+    m_allowTight = true;
+
+    m_windowStart = -1;
+    m_updates = 0;
+    m_wallNsecs = 0;
+    m_cpuNsecs = 0;
+    m_minRoundTripNsecs = -1;
+    m_pixels = 0;
+
+    m_vote = Stay;
+    m_votes = 0;
+    m_lastSwitch = -1;
+}
+
+void VncEncodingController::setAllowTight(bool allow)
+{
+    m_allowTight = allow;
+}
+
+const VncEncodingController::Profile &VncEncodingController::profile() const
+{
+    return PROFILES[m_profile];
+}
+
+bool VncEncodingController::addSample(const Sample &sample, qint64 now)
+{
+    if (m_windowStart < 0) {
+        m_windowStart = now - sample.wallNsecs;
+    }
+    if (m_lastSwitch < 0) {
+        m_lastSwitch = m_windowStart;
+    }
+
+    m_updates++;
+    m_wallNsecs += sample.wallNsecs;
+    m_cpuNsecs += sample.cpuNsecs;
+    m_pixels += sample.pixels;
+    if (sample.roundTripNsecs >= 0 && (m_minRoundTripNsecs < 0 || sample.roundTripNsecs < m_minRoundTripNsecs)) {
+        m_minRoundTripNsecs = sample.roundTripNsecs;
+    }
+
+    if (now - m_windowStart < WINDOW_NSECS || m_updates < WINDOW_MIN_UPDATES) {
+        return false;
+    }
+
+    const Direction direction = evaluateWindow();
+    const qint64 avgWire = (m_wallNsecs - m_cpuNsecs) / m_updates;
+    const qint64 avgCpu = m_cpuNsecs / m_updates;
+    const qint64 roundTrip = m_minRoundTripNsecs;
+    const double megapixelsPerSecond = m_wallNsecs > 0 ? m_pixels * 1000.0 / m_wallNsecs : 0;
+
+    m_windowStart = now;
+    m_updates = 0;
+    m_wallNsecs = 0;
+    m_cpuNsecs = 0;
+    m_minRoundTripNsecs = -1;
+    m_pixels = 0;
+
+    if (direction == Stay) {
+        m_vote = Stay;
+        m_votes = 0;
+        return false;
+    }
+    m_votes = (direction == m_vote) ? m_votes + 1 : 1;
+    m_vote = direction;
+
+    const int next = neighbour(direction);
+    if (next < 0 || m_votes < VOTES_TO_SWITCH || now - m_lastSwitch < MIN_DWELL_NSECS) {
+        return false;
+    }
+
+    qCInfo(KRDC) << "Switching VNC encoding profile from" << PROFILES[m_profile].name << "to" << PROFILES[next].name << "- wait per update (ms):" << avgWire / MSEC
+                 << "decode per update (ms):" << avgCpu / MSEC << "round trip (ms):" << roundTrip / MSEC << "throughput (Mpx/s):" << megapixelsPerSecond;
+
+    m_profile = next;
+    m_vote = Stay;
+    m_votes = 0;
+    m_lastSwitch = now;
+    return true;
+}
+
+VncEncodingController::Direction VncEncodingController::evaluateWindow() const
+{
+    const qint64 avgWire = (m_wallNsecs - m_cpuNsecs) / m_updates;
+    const qint64 avgCpu = m_cpuNsecs / m_updates;
+
+    // m_minRoundTripNsecs is -1 if no update in the window had one.
+    if (avgWire > CONGESTED_WIRE_NSECS || m_minRoundTripNsecs > CONGESTED_ROUND_TRIP_NSECS) {
+        return Compact;
+    }
+    // Nothing is known about a link without a round trip.
+    if (m_minRoundTripNsecs >= 0 && m_minRoundTripNsecs < IDLE_ROUND_TRIP_NSECS && avgWire < IDLE_WIRE_NSECS && avgCpu < IDLE_CPU_NSECS
+        && m_pixels >= RICHER_MIN_PIXELS) {
+        return Richer;
+    }
+    return Stay;
+}
+
+int VncEncodingController::neighbour(Direction direction) const
+{
+    const int step = (direction == Compact) ? 1 : -1;
+    for (int i = m_profile + step; i >= 0 && i < PROFILE_COUNT; i += step) {
+        if (m_allowTight || !PROFILES[i].usesTight) {
+            return i;
+        }
+    }
+    return -1;
+}
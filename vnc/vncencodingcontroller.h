@@ -0,0 +1,91 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#ifndef VNCENCODINGCONTROLLER_H
+#define VNCENCODINGCONTROLLER_H
+
+#include "remoteview.h"
+
+/**
+ * Picks the encodings, compression and JPEG quality requested from the
+ * server, starting from the quality chosen for the connection and moving
+ * between profiles as the measured link and decode cost change.
+ *
+ * Only used by the VNC thread, no locking.
+ */
+class VncEncodingController
+{
+public:
+    struct Profile {
+        // Not translated, used in logs and status messages.
+        const char *name;
+        const char *encodings;
+        int compressLevel;
+        int qualityLevel;
+        // Tight is not supported by libvncclient at 8 bits per pixel.
+        bool usesTight;
+    };
+
+    /**
+     * Cost of one framebuffer update, as seen by the VNC thread.
+     */
+    struct Sample {
+        // Time spent handling the update message, reading included.
+        qint64 wallNsecs = 0;
+        // Thread CPU time spent in it, i.e. decoding.
+        qint64 cpuNsecs = 0;
+        // Round trip time of the connection, not of the update, which the
+        // server may hold back until something changes. -1 if unknown.
+        qint64 roundTripNsecs = 0;
+        qint64 pixels = 0;
+    };
+
+    VncEncodingController();
+
+    /**
+     * Start over from the profile matching @p quality, for a new connection.
+     */
+    void reset(RemoteView::Quality quality);
+    void setAllowTight(bool allow);
+    const Profile &profile() const;
+
+    /**
+     * Account for one update at time @p now (nanoseconds, any monotonic
+     * origin). Returns true if profile() changed and should be sent to the
+     * server.
+     */
+    bool addSample(const Sample &sample, qint64 now);
+
+private:
+    enum Direction {
+        Stay,
+        Richer,
+        Compact,
+    };
+
+    Direction evaluateWindow() const;
+    // Next profile from m_profile in the given direction, or -1.
+    int neighbour(Direction direction) const;
+
+    int m_profile;
+    bool m_allowTight;
+
+    // Measurement window.
+    qint64 m_windowStart;
+    int m_updates;
+    qint64 m_wallNsecs;
+    qint64 m_cpuNsecs;
+    qint64 m_minRoundTripNsecs;
+    qint64 m_pixels;
+
+    // Hysteresis: consecutive windows voting for the same direction, and
+    // time of the last switch.
+    Direction m_vote;
+    int m_votes;
+    qint64 m_lastSwitch;
+};
+
+#endif
@@ -18,6 +18,11 @@ static const char use_ssh_tunnel_loopback_config_key[] = "use_ssh_tunnel_loopbac
 static const char ssh_tunnel_port_config_key[] = "ssh_tunnel_port";
 static const char ssh_tunnel_user_name_config_key[] = "ssh_tunnel_user_name";
 static const char dont_copy_passwords_config_key[] = "dont_copy_passwords";
+static const char coalesce_pointer_motion_config_key[] = "coalesce_pointer_motion";
+static const char adaptive_encoding_config_key[] = "adaptive_encoding";
+static const char server_scaling_config_key[] = "server_scaling";
+static const char remote_resize_config_key[] = "remote_resize";
+static const char update_rate_config_key[] = "update_rate";
 
 VncHostPreferences::VncHostPreferences(KConfigGroup configGroup, QObject *parent)
     : HostPreferences(configGroup, parent)
@@ -61,6 +66,14 @@ QWidget *VncHostPreferences::createProtocolSpecificConfigPage()
 #endif
 
     vncUi.dont_copy_passwords->setChecked(dontCopyPasswords());
+    vncUi.coalesce_pointer_motion->setChecked(coalescePointerMotion());
+    vncUi.adaptive_encoding->setChecked(adaptiveEncoding());
+    vncUi.server_scaling->setChecked(serverScaling());
+    vncUi.remote_resize->setChecked(remoteResize());
+    vncUi.update_rate->setValue(updateRate());
+#ifndef LIBVNCCLIENT_HAS_EXTDESKTOPSIZE
+    vncUi.remote_resize->hide();
+#endif
 
     return vncPage;
 }
@@ -140,6 +153,11 @@ void VncHostPreferences::acceptConfig()
     setSshTunnelPort(vncUi.ssh_tunnel_port->value());
     setSshTunnelUserName(vncUi.ssh_tunnel_user_name->text());
     setDontCopyPasswords(vncUi.dont_copy_passwords->isChecked());
+    setCoalescePointerMotion(vncUi.coalesce_pointer_motion->isChecked());
+    setAdaptiveEncoding(vncUi.adaptive_encoding->isChecked());
+    setServerScaling(vncUi.server_scaling->isChecked());
+    setRemoteResize(vncUi.remote_resize->isChecked());
+    setUpdateRate(vncUi.update_rate->value());
 }
 
 void VncHostPreferences::setQuality(RemoteView::Quality quality)
@@ -202,3 +220,53 @@ void VncHostPreferences::setDontCopyPasswords(bool dontCopyPasswords)
 {
     m_configGroup.writeEntry(dont_copy_passwords_config_key, dontCopyPasswords);
 }
+
+bool VncHostPreferences::coalescePointerMotion() const
+{
+    return m_configGroup.readEntry(coalesce_pointer_motion_config_key, true);
+}
+
+void VncHostPreferences::setCoalescePointerMotion(bool coalesce)
+{
+    m_configGroup.writeEntry(coalesce_pointer_motion_config_key, coalesce);
+}
+
+bool VncHostPreferences::adaptiveEncoding() const
+{
+    return m_configGroup.readEntry(adaptive_encoding_config_key, true);
+}
+
+void VncHostPreferences::setAdaptiveEncoding(bool adaptive)
+{
+    m_configGroup.writeEntry(adaptive_encoding_config_key, adaptive);
+}
+
+bool VncHostPreferences::serverScaling() const
+{
+    return m_configGroup.readEntry(server_scaling_config_key, true);
+}
+
+void VncHostPreferences::setServerScaling(bool serverScaling)
+{
+    m_configGroup.writeEntry(server_scaling_config_key, serverScaling);
+}
+
+bool VncHostPreferences::remoteResize() const
+{
+    return m_configGroup.readEntry(remote_resize_config_key, false);
+}
+
+void VncHostPreferences::setRemoteResize(bool remoteResize)
+{
+    m_configGroup.writeEntry(remote_resize_config_key, remoteResize);
+}
+
+int VncHostPreferences::updateRate() const
+{
+    return m_configGroup.readEntry(update_rate_config_key, 60);
+}
+
+void VncHostPreferences::setUpdateRate(int fps)
+{
+    m_configGroup.writeEntry(update_rate_config_key, fps);
+}
@@ -26,6 +26,11 @@ public:
     int sshTunnelPort() const;
     QString sshTunnelUserName() const;
     bool dontCopyPasswords() const;
+    bool coalescePointerMotion() const;
+    bool adaptiveEncoding() const;
+    bool serverScaling() const;
+    bool remoteResize() const;
+    int updateRate() const;
 
 protected:
     void acceptConfig() override;
@@ -38,6 +43,11 @@ private:
     void setSshTunnelPort(int port);
     void setSshTunnelUserName(const QString &userName);
     void setDontCopyPasswords(bool dontCopyPasswords);
+    void setCoalescePointerMotion(bool coalesce);
+    void setAdaptiveEncoding(bool adaptive);
+    void setServerScaling(bool serverScaling);
+    void setRemoteResize(bool remoteResize);
+    void setUpdateRate(int fps);
 
     Ui::VncPreferences vncUi;
     void checkEnableCustomSize(int index);
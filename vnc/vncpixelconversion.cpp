@@ -0,0 +1,262 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "vncpixelconversion.h"
+
+#include <QImage>
+#include <QRegion>
+#include <QThreadPool>
+
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define KRDC_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+// Work is split across threads once each thread gets at least this many
+// pixels, about a 512x512 area.
+static const qint64 PARALLEL_BAND_MIN_PIXELS = 512 * 512;
+
+using Rgb16Kernel = void (*)(const quint16 *, quint32 *, int);
+using Rgb332Kernel = void (*)(const quint8 *, quint32 *, int);
+
+static void rgb16ToRgb32Generic(const quint16 *src, quint32 *dst, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        const quint32 pixel = src[i];
+        const quint32 r = pixel >> 11;
+        const quint32 g = (pixel >> 5) & 0x3f;
+        const quint32 b = pixel & 0x1f;
+        dst[i] = 0xff000000 | (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+    }
+}
+
+static void rgb332ToRgb32Generic(const quint8 *src, quint32 *dst, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        const quint32 pixel = src[i];
+        dst[i] = 0xff000000 | ((pixel & 0x07) << 21) | ((pixel & 0x38) << 10) | (pixel & 0xc0);
+    }
+}
+
+#ifdef KRDC_X86_DISPATCH
+
+// The vector kernels work on 16 bit lanes holding one pixel each: they build
+// a "blue | green << 8" and a "red | alpha << 8" word per pixel and interleave
+// them, which gives little endian 0xAARRGGBB.
+
+__attribute__((target("sse2"))) static inline void storeRgb32Sse2(__m128i r, __m128i g, __m128i b, quint32 *dst)
+{
+    const __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    const __m128i ra = _mm_or_si128(r, _mm_set1_epi16(short(0xff00)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi16(bg, ra));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4), _mm_unpackhi_epi16(bg, ra));
+}
+
+__attribute__((target("sse2"))) static inline void expand332Sse2(__m128i pixels, quint32 *dst)
+{
+    const __m128i r = _mm_slli_epi16(_mm_and_si128(pixels, _mm_set1_epi16(0x07)), 5);
+    const __m128i g = _mm_slli_epi16(_mm_and_si128(pixels, _mm_set1_epi16(0x38)), 2);
+    const __m128i b = _mm_and_si128(pixels, _mm_set1_epi16(0xc0));
+    storeRgb32Sse2(r, g, b, dst);
+}
+
+__attribute__((target("sse2"))) static void rgb16ToRgb32Sse2(const quint16 *src, quint32 *dst, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i r = _mm_srli_epi16(pixels, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(pixels, 5), _mm_set1_epi16(0x3f));
+        __m128i b = _mm_and_si128(pixels, _mm_set1_epi16(0x1f));
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        storeRgb32Sse2(r, g, b, dst + i);
+    }
+    rgb16ToRgb32Generic(src + i, dst + i, count - i);
+}
+
+__attribute__((target("sse2"))) static void rgb332ToRgb32Sse2(const quint8 *src, quint32 *dst, int count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        expand332Sse2(_mm_unpacklo_epi8(pixels, zero), dst + i);
+        expand332Sse2(_mm_unpackhi_epi8(pixels, zero), dst + i + 8);
+    }
+    rgb332ToRgb32Generic(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static inline void storeRgb32Avx2(__m256i r, __m256i g, __m256i b, quint32 *dst)
+{
+    const __m256i bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+    const __m256i ra = _mm256_or_si256(r, _mm256_set1_epi16(short(0xff00)));
+    // The unpacks work per 128 bit lane: lo holds pixels 0-3 and 8-11, hi
+    // holds 4-7 and 12-15. Put them back in order.
+    const __m256i lo = _mm256_unpacklo_epi16(bg, ra);
+    const __m256i hi = _mm256_unpackhi_epi16(bg, ra);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+__attribute__((target("avx2"))) static void rgb16ToRgb32Avx2(const quint16 *src, quint32 *dst, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i r = _mm256_srli_epi16(pixels, 11);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi16(pixels, 5), _mm256_set1_epi16(0x3f));
+        __m256i b = _mm256_and_si256(pixels, _mm256_set1_epi16(0x1f));
+        r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+        g = _mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4));
+        b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+        storeRgb32Avx2(r, g, b, dst + i);
+    }
+    rgb16ToRgb32Generic(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void rgb332ToRgb32Avx2(const quint8 *src, quint32 *dst, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256i pixels = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)));
+        const __m256i r = _mm256_slli_epi16(_mm256_and_si256(pixels, _mm256_set1_epi16(0x07)), 5);
+        const __m256i g = _mm256_slli_epi16(_mm256_and_si256(pixels, _mm256_set1_epi16(0x38)), 2);
+        const __m256i b = _mm256_and_si256(pixels, _mm256_set1_epi16(0xc0));
+        storeRgb32Avx2(r, g, b, dst + i);
+    }
+    rgb332ToRgb32Generic(src + i, dst + i, count - i);
+}
+
+#endif // KRDC_X86_DISPATCH
+
+static Rgb16Kernel resolveRgb16Kernel()
+{
+#ifdef KRDC_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return rgb16ToRgb32Avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return rgb16ToRgb32Sse2;
+    }
+#endif
+    return rgb16ToRgb32Generic;
+}
+
+static Rgb332Kernel resolveRgb332Kernel()
+{
+#ifdef KRDC_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return rgb332ToRgb32Avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return rgb332ToRgb32Sse2;
+    }
+#endif
+    return rgb332ToRgb32Generic;
+}
+
+void convertRgb16ToRgb32(const quint16 *src, quint32 *dst, int count)
+{
+    static const Rgb16Kernel kernel = resolveRgb16Kernel();
+    kernel(src, dst, count);
+}
+
+void convertRgb332ToRgb32(const quint8 *src, quint32 *dst, int count)
+{
+    static const Rgb332Kernel kernel = resolveRgb332Kernel();
+    kernel(src, dst, count);
+}
+
+// Call work for region, split in horizontal bands processed in parallel by
+// pool and the calling thread when region is large enough. work must only
+// write to the rows of the region it is given, through pointers obtained
+// on the calling thread: non-const QImage accessors may detach, which is
+// not thread safe even when the rows written are disjoint.
+template<typename Work>
+static void forEachBand(QThreadPool *pool, const QRegion &region, Work work)
+{
+    if (!pool) {
+        work(region);
+        return;
+    }
+
+    qint64 pixels = 0;
+    for (const QRect &rect : region) {
+        pixels += qint64(rect.width()) * rect.height();
+    }
+    const int bands = int(qMin<qint64>(pool->maxThreadCount() + 1, pixels / PARALLEL_BAND_MIN_PIXELS));
+    if (bands < 2) {
+        work(region);
+        return;
+    }
+
+    const QRect bounds = region.boundingRect();
+    const int bandHeight = (bounds.height() + bands - 1) / bands;
+    for (int i = 1; i < bands; ++i) {
+        const QRegion band = region & QRect(bounds.left(), bounds.top() + i * bandHeight, bounds.width(), bandHeight);
+        pool->start([work, band]() {
+            work(band);
+        });
+    }
+    work(region & QRect(bounds.left(), bounds.top(), bounds.width(), bandHeight));
+    pool->waitForDone();
+}
+
+void copyImageRegion(QImage &dst, const QImage &src, const QRegion &region)
+{
+    uchar *const dstBits = dst.bits();
+    const uchar *const srcBits = src.constBits();
+    const qsizetype dstBytesPerLine = dst.bytesPerLine();
+    const qsizetype srcBytesPerLine = src.bytesPerLine();
+    const int bytesPerPixel = src.depth() / 8;
+    const QRect bounds = src.rect();
+
+    for (const QRect &r : region) {
+        const QRect rect = r.intersected(bounds);
+        const qsizetype offset = rect.x() * bytesPerPixel;
+        const qsizetype length = rect.width() * bytesPerPixel;
+        for (int y = rect.top(); y <= rect.bottom(); ++y) {
+            memcpy(dstBits + y * dstBytesPerLine + offset, srcBits + y * srcBytesPerLine + offset, length);
+        }
+    }
+}
+
+void convertImageRegion(QImage &dst, const QImage &src, const QRegion &region, QThreadPool *pool)
+{
+    uchar *const dstBits = dst.bits();
+    const uchar *const srcBits = src.constBits();
+    const qsizetype dstBytesPerLine = dst.bytesPerLine();
+    const qsizetype srcBytesPerLine = src.bytesPerLine();
+    const QImage::Format format = src.format();
+    const QRect bounds = src.rect();
+
+    forEachBand(pool, region, [=](const QRegion &band) {
+        for (const QRect &r : band) {
+            const QRect rect = r.intersected(bounds);
+            for (int y = rect.top(); y <= rect.bottom(); ++y) {
+                quint32 *line = reinterpret_cast<quint32 *>(dstBits + y * dstBytesPerLine) + rect.x();
+                const uchar *source = srcBits + y * srcBytesPerLine;
+                switch (format) {
+                case QImage::Format_Indexed8:
+                    convertRgb332ToRgb32(source + rect.x(), line, rect.width());
+                    break;
+                case QImage::Format_RGB16:
+                    convertRgb16ToRgb32(reinterpret_cast<const quint16 *>(source) + rect.x(), line, rect.width());
+                    break;
+                default:
+                    memcpy(line, reinterpret_cast<const quint32 *>(source) + rect.x(), rect.width() * sizeof(quint32));
+                    break;
+                }
+            }
+        }
+    });
+}
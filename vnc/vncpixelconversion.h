@@ -0,0 +1,37 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#ifndef VNCPIXELCONVERSION_H
+#define VNCPIXELCONVERSION_H
+
+#include <QtGlobal>
+
+class QImage;
+class QRegion;
+class QThreadPool;
+
+// Expand count RGB565 pixels (host byte order) into QImage::Format_RGB32
+// pixels, replicating the high bits into the low ones like Qt does.
+void convertRgb16ToRgb32(const quint16 *src, quint32 *dst, int count);
+
+// Expand count 8 bit true colour pixels (red in bits 0-2, green in bits 3-5,
+// blue in bits 6-7, see VncClientThread::setClientColorDepth()) into
+// QImage::Format_RGB32 pixels. The result matches the 3-3-2 colour table
+// used for Format_Indexed8 framebuffers.
+void convertRgb332ToRgb32(const quint8 *src, quint32 *dst, int count);
+
+// Copy the parts of src covered by region into dst. Both images must have
+// the same size and format.
+void copyImageRegion(QImage &dst, const QImage &src, const QRegion &region);
+
+// Convert the parts of src covered by region into dst, which must be a
+// Format_RGB32 image of the same size. Large regions, e.g. a full screen
+// update at 4K, are split in horizontal bands also handled by pool if
+// given. Keeping the published frame in RGB32 means QPainter never has to
+// convert 8 and 16 bit framebuffers on paint.
+void convertImageRegion(QImage &dst, const QImage &src, const QRegion &region, QThreadPool *pool = nullptr);
+
+#endif
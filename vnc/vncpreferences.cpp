@@ -35,6 +35,14 @@ VncPreferences::VncPreferences(QObject *parent)
     vncUi.heightLabel->setEnabled(true);
     vncUi.widthLabel->setEnabled(true);
 
+    // Per host settings only, they have no global counterpart to load and save.
+    vncUi.updateRateLabel->hide();
+    vncUi.update_rate->hide();
+    vncUi.coalesce_pointer_motion->hide();
+    vncUi.adaptive_encoding->hide();
+    vncUi.remote_resize->hide();
+    vncUi.server_scaling->hide();
+
 #if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
     addConfig(Settings::self(), this);
 #else
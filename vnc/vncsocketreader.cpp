@@ -0,0 +1,185 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "vncsocketreader.h"
+#include "krdc_debug.h"
+
+#include <QMutexLocker>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Enough for a few full screen updates at 4K with a lossless encoding. Once
+// full, the reader stops and TCP flow control slows the server down again.
+static const size_t BUFFER_SIZE = 4 * 1024 * 1024;
+
+VncSocketReader::VncSocketReader()
+    : m_socket(-1)
+    , m_notifyPipe{-1, -1}
+    , m_head(0)
+    , m_tail(0)
+    , m_stopped(false)
+    , m_finished(false)
+    , m_error(0)
+    , m_maxBuffered(0)
+{
+}
+
+VncSocketReader::~VncSocketReader()
+{
+    stopReading();
+}
+
+bool VncSocketReader::startReading(int sock)
+{
+    Q_ASSERT(m_socket < 0);
+
+    if (pipe(m_notifyPipe) < 0) {
+        qCWarning(KRDC) << "Could not create the socket reader pipe:" << strerror(errno);
+        m_notifyPipe[0] = m_notifyPipe[1] = -1;
+        return false;
+    }
+    for (int fd : m_notifyPipe) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    if (m_buffer.empty()) {
+        m_buffer.resize(BUFFER_SIZE);
+    }
+    m_socket = sock;
+    m_head = m_tail = 0;
+    m_stopped = false;
+    m_finished = false;
+    m_error = 0;
+    m_maxBuffered = 0;
+    start();
+    return true;
+}
+
+void VncSocketReader::stopReading()
+{
+    if (m_socket < 0) {
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_stopped = true;
+    m_finished = true;
+    m_readable.wakeAll();
+    m_writable.wakeAll();
+    locker.unlock();
+
+    // Interrupts a blocking poll() or read() of the reader.
+    shutdown(m_socket, SHUT_RD);
+    wait();
+
+    qCDebug(KRDC) << "Socket reader received" << m_head << "bytes, at most" << m_maxBuffered << "waiting to be decoded";
+
+    close(m_notifyPipe[0]);
+    close(m_notifyPipe[1]);
+    m_notifyPipe[0] = m_notifyPipe[1] = -1;
+    m_socket = -1;
+}
+
+bool VncSocketReader::isReading() const
+{
+    return m_socket >= 0;
+}
+
+int VncSocketReader::read(char *buffer, unsigned int size)
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_head == m_tail && !m_finished) {
+        m_readable.wait(&m_mutex);
+    }
+    if (m_head == m_tail) {
+        errno = m_error;
+        return m_error ? -1 : 0;
+    }
+
+    const size_t offset = m_tail % m_buffer.size();
+    const size_t count = qMin(qMin<size_t>(size, m_head - m_tail), m_buffer.size() - offset);
+    locker.unlock();
+
+    memcpy(buffer, m_buffer.data() + offset, count);
+
+    locker.relock();
+    m_tail += count;
+    m_writable.wakeAll();
+    return int(count);
+}
+
+bool VncSocketReader::canRead()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_head != m_tail || m_finished;
+}
+
+int VncSocketReader::notifier() const
+{
+    return m_notifyPipe[0];
+}
+
+void VncSocketReader::clearNotification()
+{
+    char buffer[64];
+    while (::read(m_notifyPipe[0], buffer, sizeof(buffer)) > 0) { }
+}
+
+void VncSocketReader::notify()
+{
+    const char byte = 0;
+    // If the pipe is full, it is readable already.
+    if (write(m_notifyPipe[1], &byte, 1) < 0 && errno != EAGAIN) {
+        qCWarning(KRDC) << "Could not notify the VNC thread:" << strerror(errno);
+    }
+}
+
+void VncSocketReader::run()
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_stopped) {
+        if (m_head - m_tail == m_buffer.size()) {
+            m_writable.wait(&m_mutex);
+            continue;
+        }
+        const size_t offset = m_head % m_buffer.size();
+        const size_t space = qMin(m_buffer.size() - (m_head - m_tail), m_buffer.size() - offset);
+        locker.unlock();
+
+        const ssize_t count = ::read(m_socket, m_buffer.data() + offset, space);
+        const int error = errno;
+        if (count < 0 && (error == EAGAIN || error == EWOULDBLOCK || error == EINTR)) {
+            pollfd fd;
+            fd.fd = m_socket;
+            fd.events = POLLIN;
+            fd.revents = 0;
+            poll(&fd, 1, -1);
+            locker.relock();
+            continue;
+        }
+
+        locker.relock();
+        const bool wasEmpty = m_head == m_tail;
+        if (count > 0) {
+            m_head += count;
+            m_maxBuffered = qMax(m_maxBuffered, m_head - m_tail);
+        } else {
+            m_finished = true;
+            m_error = count < 0 ? error : 0;
+            m_stopped = true;
+        }
+        m_readable.wakeAll();
+        if (wasEmpty) {
+            notify();
+        }
+    }
+}
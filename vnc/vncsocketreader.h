@@ -0,0 +1,79 @@
+/*
+    SPDX-FileCopyrightText: 2026 KRDC developers
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#ifndef VNCSOCKETREADER_H
+#define VNCSOCKETREADER_H
+
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <vector>
+
+/**
+ * Reads the socket of a VNC connection on its own thread into a ring
+ * buffer, which libvncclient then reads from instead of the socket. This
+ * keeps the TCP receive window open while the VNC thread is busy decoding.
+ *
+ * Not usable with TLS or SASL, which read the socket themselves.
+ */
+class VncSocketReader : public QThread
+{
+public:
+    VncSocketReader();
+    ~VncSocketReader() override;
+
+    /**
+     * Start reading @p sock, blocking or not. Returns false if the
+     * notification pipe could not be created.
+     */
+    bool startReading(int sock);
+    /**
+     * Shut down the reading side of the socket and wait for the thread.
+     * Does nothing if not reading.
+     */
+    void stopReading();
+    bool isReading() const;
+
+    /**
+     * Consumer side. Block until data is buffered or the stream ended, and
+     * return like read(2), setting errno on error.
+     */
+    int read(char *buffer, unsigned int size);
+    // Whether read() would return right away.
+    bool canRead();
+    // Readable when canRead() may have become true, for poll(). Cleared by
+    // clearNotification().
+    int notifier() const;
+    void clearNotification();
+
+protected:
+    void run() override;
+
+private:
+    void notify();
+
+    int m_socket;
+    int m_notifyPipe[2];
+
+    // Protects everything below but the contents of m_buffer: the reader
+    // only writes beyond m_head and the consumer only reads before it.
+    QMutex m_mutex;
+    QWaitCondition m_readable;
+    QWaitCondition m_writable;
+    std::vector<char> m_buffer;
+    // Total bytes written and read, positions in m_buffer modulo its size.
+    size_t m_head;
+    size_t m_tail;
+    bool m_stopped;
+    // End of stream (m_error is 0) or read error (errno in m_error).
+    bool m_finished;
+    int m_error;
+    // Most bytes waiting for the consumer at once.
+    size_t m_maxBuffered;
+};
+
+#endif
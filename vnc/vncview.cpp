@@ -8,12 +8,15 @@
 #include "vncview.h"
 #include "krdc_debug.h"
 
+#include <QAbstractScrollArea>
 #include <QApplication>
 #include <QImage>
 #include <QMimeData>
 #include <QMouseEvent>
 #include <QPainter>
+#include <QScrollBar>
 #include <QTimer>
+#include <QtMath>
 
 #ifdef QTONLY
 #include <QInputDialog>
@@ -47,6 +50,7 @@ VncView::VncView(QWidget *parent, const QUrl &url, KConfigGroup configGroup)
     , m_verticalFactor(1.0)
     , m_wheelRemainderV(0)
     , m_wheelRemainderH(0)
+    , m_remoteResize(false)
     , m_forceLocalCursor(false)
 #ifdef LIBSSH_FOUND
     , m_sshTunnelThread(nullptr)
@@ -62,11 +66,14 @@ VncView::VncView(QWidget *parent, const QUrl &url, KConfigGroup configGroup)
     if (m_port < 100) // the user most likely used the short form (e.g. :1)
         m_port += 5900;
 
+    // Frames and clipboard contents are handed over without blocking, so a busy GUI never stalls
+    // the VNC thread's network reads.
+    connect(&vncThread, SIGNAL(imageUpdated()), this, SLOT(updateImage()), Qt::QueuedConnection);
+    connect(&vncThread, SIGNAL(gotCut(QString)), this, SLOT(setCut(QString)), Qt::QueuedConnection);
     // BlockingQueuedConnection can cause deadlocks when exiting, handled in startQuitting()
-    connect(&vncThread, SIGNAL(imageUpdated(int, int, int, int)), this, SLOT(updateImage(int, int, int, int)), Qt::BlockingQueuedConnection);
-    connect(&vncThread, SIGNAL(gotCut(QString)), this, SLOT(setCut(QString)), Qt::BlockingQueuedConnection);
     connect(&vncThread, SIGNAL(passwordRequest(bool)), this, SLOT(requestPassword(bool)), Qt::BlockingQueuedConnection);
     connect(&vncThread, SIGNAL(outputErrorMessage(QString)), this, SLOT(outputErrorMessage(QString)));
+    connect(&vncThread, SIGNAL(statusMessage(QString)), this, SIGNAL(statusMessage(QString)), Qt::QueuedConnection);
     connect(&vncThread, &VncClientThread::gotCursor, this, [this](QCursor cursor) {
         setCursor(cursor);
     });
@@ -74,6 +81,11 @@ VncView::VncView(QWidget *parent, const QUrl &url, KConfigGroup configGroup)
     m_clipboard = QApplication::clipboard();
     connect(m_clipboard, SIGNAL(dataChanged()), this, SLOT(clipboardDataChanged()));
 
+    // Interactive resizing produces a stream of sizes, only send the last.
+    m_desktopSizeTimer.setSingleShot(true);
+    m_desktopSizeTimer.setInterval(300);
+    connect(&m_desktopSizeTimer, SIGNAL(timeout()), this, SLOT(requestDesktopSize()));
+
 #ifndef QTONLY
     m_hostPreferences = new VncHostPreferences(configGroup, this);
 #else
@@ -137,7 +149,25 @@ void VncView::scaleResize(int w, int h)
         const qreal newH = frameSize.height() * m_verticalFactor;
         setMaximumSize(newW, newH); // This is a hack to force Qt to center the view in the scroll area
         resize(newW, newH);
+
+        // Mouse coordinates need no special care if the server scales: they
+        // are mapped to m_frame, which is then the scaled framebuffer.
+        vncThread.setScaleTarget(QSizeF(w * m_factor, h * m_factor).toSize() * devicePixelRatioF());
+
+        if (m_remoteResize) {
+            m_desktopSize = QSize(w, h) * devicePixelRatioF();
+            m_desktopSizeTimer.start();
+        }
     }
+
+    updateViewport();
+}
+
+void VncView::requestDesktopSize()
+{
+    // The server answers with a new framebuffer size, which brings us back
+    // to scaleResize() with a scale factor of 1.
+    vncThread.requestDesktopSize(m_desktopSize);
 }
 
 void VncView::updateConfiguration()
@@ -179,8 +209,9 @@ void VncView::startQuitting()
 
     const bool quitSuccess = vncThread.wait(500);
     if (!quitSuccess) {
-        // happens when vncThread wants to call a slot via BlockingQueuedConnection,
-        // needs an event loop in this thread so execution continues after 'emit'
+        // happens when vncThread wants to call a slot via BlockingQueuedConnection
+        // (password requests), needs an event loop in this thread so execution
+        // continues after 'emit'
         QEventLoop loop;
         if (!loop.processEvents()) {
             qCDebug(KRDC) << "BUG: deadlocked, but no events to deliver?";
@@ -240,6 +271,15 @@ bool VncView::start()
 
     vncThread.setQuality(quality);
     vncThread.setDevicePixelRatio(devicePixelRatioF());
+#ifndef QTONLY
+    vncThread.setCoalescePointerMotion(m_hostPreferences->coalescePointerMotion());
+    vncThread.setAdaptiveEncoding(m_hostPreferences->adaptiveEncoding());
+    vncThread.setServerScaling(m_hostPreferences->serverScaling());
+    vncThread.setUpdateRate(m_hostPreferences->updateRate());
+#ifdef LIBVNCCLIENT_HAS_EXTDESKTOPSIZE
+    m_remoteResize = m_hostPreferences->remoteResize();
+#endif
+#endif
 
     // set local cursor on by default because low quality mostly means slow internet connection
     if (quality == RemoteView::Low) {
@@ -419,11 +459,90 @@ HostPreferences *VncView::hostPreferences()
 }
 #endif
 
-void VncView::updateImage(int x, int y, int w, int h)
+QRect VncView::mapFromFramebuffer(const QRect &rect) const
+{
+    const auto dpr = m_frame.devicePixelRatio();
+    return QRectF(rect.x() / dpr * m_horizontalFactor,
+                  rect.y() / dpr * m_verticalFactor,
+                  rect.width() / dpr * m_horizontalFactor,
+                  rect.height() / dpr * m_verticalFactor)
+        .toAlignedRect()
+        .adjusted(-1, -1, 1, 1);
+}
+
+QRect VncView::mapToFramebuffer(const QRect &rect) const
+{
+    const auto dpr = m_frame.devicePixelRatio();
+    return QRectF(rect.x() * dpr / m_horizontalFactor,
+                  rect.y() * dpr / m_verticalFactor,
+                  rect.width() * dpr / m_horizontalFactor,
+                  rect.height() * dpr / m_verticalFactor)
+        .toAlignedRect();
+}
+
+bool VncView::scrollFramebufferCopy(const FramebufferCopy &copy, QRegion &dirty)
+{
+    const auto dpr = m_frame.devicePixelRatio();
+    const qreal xScale = m_horizontalFactor / dpr;
+    const qreal yScale = m_verticalFactor / dpr;
+    const QRect destination = copy.source.translated(copy.dx, copy.dy);
+
+    // QWidget::scroll() moves a rectangle within itself, which is only the
+    // copy if source and destination line up, as when scrolling text.
+    const QRegion area = QRegion(copy.source).united(destination);
+    if (area.rectCount() != 1 || dirty.intersects(mapFromFramebuffer(copy.source))) {
+        return false;
+    }
+
+    // The scaled pixels only move unchanged if the offset is a whole number
+    // of widget pixels.
+    const qreal dx = copy.dx * xScale;
+    const qreal dy = copy.dy * yScale;
+    const int scrollX = qRound(dx);
+    const int scrollY = qRound(dy);
+    if (qAbs(dx - scrollX) > 0.01 || qAbs(dy - scrollY) > 0.01) {
+        return false;
+    }
+
+    // Widget pixels entirely inside the area. When scaled, smoothing blends
+    // in the neighbouring framebuffer pixels too, so leave out the edges.
+    const QRect bounds = area.boundingRect();
+    const QRectF exact(bounds.x() * xScale, bounds.y() * yScale, bounds.width() * xScale, bounds.height() * yScale);
+    QRect inner(QPoint(qCeil(exact.left()), qCeil(exact.top())), QPoint(qFloor(exact.right()) - 1, qFloor(exact.bottom()) - 1));
+    if (xScale != 1 || yScale != 1) {
+        inner.adjust(2, 2, -2, -2);
+    }
+    if (inner.isEmpty()) {
+        return false;
+    }
+
+    scroll(scrollX, scrollY, inner);
+    // Qt repaints what the scroll uncovered, the rest of the destination is
+    // up to us.
+    dirty += QRegion(mapFromFramebuffer(destination)) - inner.intersected(inner.translated(scrollX, scrollY));
+    dirty += QRegion(inner) - inner.translated(scrollX, scrollY);
+    return true;
+}
+
+void VncView::updateViewport()
+{
+    // When scaled, the whole framebuffer is visible. Otherwise only the part
+    // shown by the scroll area needs to be kept up to date.
+    const QRect frame = m_frame.rect();
+    const QRect viewport = m_scale ? frame : mapToFramebuffer(visibleRegion().boundingRect()).intersected(frame);
+    if (viewport.isEmpty() || viewport == m_viewport) {
+        return;
+    }
+    m_viewport = viewport;
+    vncThread.setViewport(viewport);
+}
+
+void VncView::updateImage()
 {
     // qCDebug(KRDC) << "got update" << width() << height();
 
-    m_frame = vncThread.image();
+    QVector<FramebufferCopy> copies;
+    const QRegion region = vncThread.takeFrame(m_frame, &copies);
 
     if (!m_initDone) {
         if (!vncThread.username().isEmpty()) {
@@ -466,8 +585,12 @@ void VncView::updateImage(int x, int y, int w, int h)
 #endif
     }
 
+    // When scaling, the widget size differs from the framebuffer size, only
+    // lay out again if the framebuffer itself changed. Otherwise every full
+    // update would request the server scale and desktop size again.
     const QSize frameSize = m_frame.size() / m_frame.devicePixelRatio();
-    if ((y == 0 && x == 0) && (frameSize != size())) {
+    if (frameSize != m_frameSize) {
+        m_frameSize = frameSize;
         qCDebug(KRDC) << "Updating framebuffer size";
         if (m_scale) {
             setMaximumSize(QSize(QWIDGETSIZE_MAX, QWIDGETSIZE_MAX));
@@ -482,10 +605,19 @@ void VncView::updateImage(int x, int y, int w, int h)
         }
     }
 
-    const auto dpr = m_frame.devicePixelRatio();
-    repaint(QRectF(x / dpr * m_horizontalFactor, y / dpr * m_verticalFactor, w / dpr * m_horizontalFactor, h / dpr * m_verticalFactor)
-                .toAlignedRect()
-                .adjusted(-1, -1, 1, 1));
+    // Move what the server copied, in order, unless it reads from something
+    // not repainted yet. Then repaint only the damaged rectangles, not their
+    // bounding box.
+    QRegion dirty;
+    for (const FramebufferCopy &copy : copies) {
+        if (!scrollFramebufferCopy(copy, dirty)) {
+            dirty += mapFromFramebuffer(copy.source.translated(copy.dx, copy.dy));
+        }
+    }
+    for (const QRect &rect : region) {
+        dirty += mapFromFramebuffer(rect);
+    }
+    repaint(dirty);
 }
 
 void VncView::setViewOnly(bool viewOnly)
@@ -527,12 +659,21 @@ void VncView::enableScaling(bool scale)
     } else {
         m_verticalFactor = 1.0;
         m_horizontalFactor = 1.0;
+        vncThread.setScaleTarget(QSize());
 
         const QSize frameSize = m_frame.size() / m_frame.devicePixelRatio();
         setMaximumSize(frameSize); // This is a hack to force Qt to center the view in the scroll area
         setMinimumSize(frameSize);
         resize(frameSize);
     }
+
+    updateViewport();
+}
+
+void VncView::setUpdatesPaused(bool paused)
+{
+    RemoteView::setUpdatesPaused(paused);
+    vncThread.setUpdatesPaused(paused);
 }
 
 void VncView::setCut(const QString &text)
@@ -557,13 +698,17 @@ void VncView::paintEvent(QPaintEvent *event)
     QPainter painter(this);
     painter.setRenderHint(QPainter::SmoothPixmapTransform);
 
+    // Draw each rectangle of the exposed region on its own, so that scattered
+    // damage does not rescale everything in between.
     const auto dpr = m_frame.devicePixelRatio();
-    const QRectF dstRect = event->rect();
-    const QRectF srcRect(dstRect.x() * dpr / m_horizontalFactor,
-                         dstRect.y() * dpr / m_verticalFactor,
-                         dstRect.width() * dpr / m_horizontalFactor,
-                         dstRect.height() * dpr / m_verticalFactor);
-    painter.drawImage(dstRect, m_frame, srcRect);
+    for (const QRect &rect : event->region()) {
+        const QRectF dstRect = rect;
+        const QRectF srcRect(dstRect.x() * dpr / m_horizontalFactor,
+                             dstRect.y() * dpr / m_verticalFactor,
+                             dstRect.width() * dpr / m_horizontalFactor,
+                             dstRect.height() * dpr / m_verticalFactor);
+        painter.drawImage(dstRect, m_frame, srcRect);
+    }
 
     RemoteView::paintEvent(event);
 }
@@ -571,9 +716,22 @@ void VncView::paintEvent(QPaintEvent *event)
 void VncView::resizeEvent(QResizeEvent *event)
 {
     RemoteView::resizeEvent(event);
+    updateViewport();
     update();
 }
 
+void VncView::watchScrollArea()
+{
+    // The scroll area sets the viewport widget as our parent. Scrolling
+    // changes what is visible, and so does resizing it, through scaleResize().
+    auto scrollArea = parentWidget() ? qobject_cast<QAbstractScrollArea *>(parentWidget()->parentWidget()) : nullptr;
+    if (!scrollArea) {
+        return;
+    }
+    connect(scrollArea->horizontalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(updateViewport()), Qt::UniqueConnection);
+    connect(scrollArea->verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(updateViewport()), Qt::UniqueConnection);
+}
+
 bool VncView::event(QEvent *event)
 {
     switch (event->type()) {
@@ -596,6 +754,9 @@ bool VncView::event(QEvent *event)
         wheelEventHandler(static_cast<QWheelEvent *>(event));
         return true;
         break;
+    case QEvent::ParentChange:
+        watchScrollArea();
+        return RemoteView::event(event);
     default:
         return RemoteView::event(event);
     }
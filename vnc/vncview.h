@@ -24,6 +24,7 @@ class KConfigGroup
 
 #include <QClipboard>
 #include <QMap>
+#include <QTimer>
 
 extern "C" {
 #include <rfb/rfbclient.h>
@@ -54,6 +55,7 @@ public:
     void setViewOnly(bool viewOnly) override;
     void showLocalCursor(LocalCursorState state) override;
     void enableScaling(bool scale) override;
+    void setUpdatesPaused(bool paused) override;
 
     void updateConfiguration() override;
 
@@ -84,6 +86,15 @@ private:
     VncHostPreferences *m_hostPreferences;
 #endif
     QImage m_frame;
+    // Framebuffer size, in widget pixels, the view was last laid out for.
+    QSize m_frameSize;
+    // Last viewport passed to the VNC thread, in framebuffer pixels.
+    QRect m_viewport;
+    // Resize the remote desktop to the window when scaling, once the window
+    // stopped changing size for a moment.
+    bool m_remoteResize;
+    QTimer m_desktopSizeTimer;
+    QSize m_desktopSize;
     bool m_forceLocalCursor;
 #ifdef LIBSSH_FOUND
     VncSshTunnelThread *m_sshTunnelThread;
@@ -92,13 +103,26 @@ private:
     void saveWalletSshPassword();
 #endif
 
+    // Map a rectangle in framebuffer pixels to widget coordinates.
+    QRect mapFromFramebuffer(const QRect &rect) const;
+    // Map a rectangle in widget coordinates to framebuffer pixels.
+    QRect mapToFramebuffer(const QRect &rect) const;
+    // Apply a CopyRect by scrolling what is on screen. Returns false if it
+    // can not be done exactly, otherwise adds the parts left to repaint to
+    // dirty.
+    bool scrollFramebufferCopy(const FramebufferCopy &copy, QRegion &dirty);
+    // Update the viewport when the scroll area we are in scrolls.
+    void watchScrollArea();
     void keyEventHandler(QKeyEvent *e);
     void unpressModifiers();
     void wheelEventHandler(QWheelEvent *event);
     void mouseEventHandler(QMouseEvent *event);
 
 private Q_SLOTS:
-    void updateImage(int x, int y, int w, int h);
+    // Tell the VNC thread which part of the framebuffer is visible.
+    void updateViewport();
+    void updateImage();
+    void requestDesktopSize();
     void setCut(const QString &text);
     void requestPassword(bool includingUsername);
 #ifdef LIBSSH_FOUND